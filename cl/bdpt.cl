@@ -0,0 +1,527 @@
+#pragma once
+
+#include <path.cl>
+
+/** @file bdpt.cl
+  * @brief Bidirectional path tracing kernel.
+  *
+  * This file is included by epsilon.cl in BDPT mode, and uses its definitions.
+  * For each sample, a camera subpath and a light subpath (from a point sampled
+  * by area on the emissive triangles) are traced, then every vertex of either
+  * subpath is connected to every vertex of the other, and each of the light
+  * paths obtained is weighted by multiple importance sampling, against every
+  * other way the same path could have been sampled (balance heuristic). Light
+  * subpath vertices connected to the camera's lens land on arbitrary pixels,
+  * so they are added to the pixel buffer atomically.
+  *
+  * Subpaths only interact with surfaces, as no material scatters light, media
+  * only absorb it along each segment (see \c scatter in material.cl). Vertices
+  * on delta surfaces (e.g. glass) can't be connected, but light subpaths find
+  * their way through them, which is what renders caustics.
+**/
+
+/** Maximum number of vertices of each subpath, including the vertex on the
+  * camera's lens or on the light source. Longer paths are cut short.
+**/
+#ifndef BDPT_VERTICES
+#define BDPT_VERTICES 6
+#endif
+
+/** Returns the density (per solid angle) with which the camera samples a
+  * direction from a point on its lens, over the whole render (each pixel
+  * receiving the same number of samples), and the pixel it lands on.
+  * @param lens The point on the lens.
+  * @param direction The direction, as a unit vector.
+  * @param params The render parameters.
+  * @param camera The virtual camera parameters.
+  * @param coords A pointer in which to store the pixel's coordinates.
+  * @returns The density of the direction, or zero if it misses the render.
+**/
+float CameraDensity(float3 lens, float3 direction, constant Params *params,
+                    constant Camera *camera, uint2 *coords)
+{
+    #ifdef SCENE_CAMERA
+    /* Use the camera parameters baked into the kernel. */
+    camera = &sceneCamera;
+    #endif
+
+    /* The focal plane's origin, edges, and normal facing away from the lens. */
+    float3 p0 = camera->p[0].xyz;
+    float3 e1 = camera->p[1].xyz - p0, e3 = camera->p[3].xyz - p0;
+    float3 forward = normalize(cross(e1, e3));
+    if (dot(forward, p0 - camera->pos.xyz) < 0) forward = -forward;
+
+    float cosTheta = dot(direction, forward);
+    if (cosTheta <= 0.0f) return 0.0f;
+
+    /* Find the normalized coordinates where the ray meets the focal plane. */
+    float h = dot(p0 - lens, forward);
+    float3 q = lens + direction * (h / cosTheta) - p0;
+    float u = dot(q, e1) / dot(e1, e1), v = dot(q, e3) / dot(e3, e3);
+
+    /* Then the pixel, undoing the mapping in CameraRay. */
+    float ratio = (float)RENDER_WIDTH / RENDER_HEIGHT;
+    float x = RENDER_WIDTH * (0.5f * (1 + ratio) - u) / ratio + 0.5f;
+    float y = RENDER_HEIGHT * v + 0.5f;
+    if ((x < 0.0f) || (y < 0.0f) || (x >= RENDER_WIDTH)
+                   || (y >= RENDER_HEIGHT)) return 0.0f;
+    *coords = (uint2)((uint)x, (uint)y);
+
+    /* Each pixel covers this area on the focal plane, and is as likely. */
+    float area = length(e1) * ratio / RENDER_WIDTH
+               * length(e3) / RENDER_HEIGHT;
+    return h * h / (cosTheta * cosTheta * cosTheta * area
+                  * RENDER_WIDTH * RENDER_HEIGHT);
+}
+
+/** Returns the density (per unit area) with which a vertex reflects a subpath
+  * coming from some point towards another vertex.
+  * @param v The reflecting vertex, which must be diffuse.
+  * @param from The point the subpath comes from.
+  * @param target The vertex the subpath is reflected towards.
+  * @param w The light path's wavelengths, in meters.
+  * @param materials The material table, indexed by material ID.
+  * @returns The density of the target vertex.
+**/
+float ScatterDensity(PathVertex *v, float3 from, PathVertex *target,
+                     float4 w, constant Material *materials)
+{
+    float3 direction = target->p - v->p;
+    float d2 = dot(direction, direction);
+    direction /= sqrt(d2);
+
+    float pdf = density(materials + v->in, materials + v->to, w,
+                        VertexTBN(normalize(v->p - from), v),
+                        VertexTBN(direction, v), v->nested);
+
+    return pdf * fabs(dot(target->n, direction)) / d2;
+}
+
+/** Returns the density (per unit area) with which a light subpath leaves a
+  * point on a light source towards a vertex, its direction being sampled by
+  * cosine, on either side of the light source.
+  * @param light The vertex on the light source.
+  * @param target The vertex the subpath goes towards.
+  * @returns The density of the target vertex.
+**/
+float EmissionDensity(PathVertex *light, PathVertex *target)
+{
+    float3 direction = target->p - light->p;
+    float d2 = dot(direction, direction);
+    direction /= sqrt(d2);
+
+    return fabs(dot(light->n, direction)) / (2 * PI)
+         * fabs(dot(target->n, direction)) / d2;
+}
+
+/** Extends a subpath by a random walk, recording a vertex at each surface it
+  * interacts with, until it is absorbed, leaves the scene, or hits a light.
+  * @param origin The origin of the subpath's next ray.
+  * @param direction The direction of the subpath's next ray.
+  * @param beta The subpath's throughput along the ray.
+  * @param pdf The density (per solid angle) of the ray's direction.
+  * @param path The subpath's vertices.
+  * @param count The number of vertices of the subpath so far, at least one.
+  * @param w The light path's wavelengths, in meters.
+  * @param prng A PRNG instance.
+  * @param escaped A pointer in which to store the subpath's throughput times
+  *                the sky's radiance, if it escapes, or zero otherwise.
+  * @param triangles The list of triangles in the scene.
+  * @param nodes The tree datastructure, as a list of nodes.
+  * @param mapping The model to material mapping.
+  * @param materials The material table, indexed by material ID.
+  * @param volumes The density grid table, see volume.cl.
+  * @param grids The densities and majorants of all grids.
+  * @param skyMap The sky map.
+  * @param sky The sky parameters.
+  * @returns The number of vertices of the subpath.
+**/
+uint RandomWalk(float3 origin, float3 direction, float4 beta, float pdf,
+                PathVertex *path, uint count, float4 w, PRNG *prng,
+                float4 *escaped, global Triangle *triangles,
+                global Node *nodes, constant uint *mapping,
+                constant Material *materials, constant Volume *volumes,
+                global float *grids, global float4 *skyMap,
+                constant Sky *sky)
+{
+    /* Media stack, starting in the atmosphere. */
+    uint matStack[MT];
+    uint matPos = 0;
+    matStack[0] = mapping[0];
+
+    *escaped = (float4)(0.0f);
+
+    /* Russian roulette compares the throughput against the initial one. */
+    float start = max(max(beta.x, beta.y), max(beta.z, beta.w));
+    uint depth = count - 1;
+
+    while (count < BDPT_VERTICES)
+    {
+        PathVertex *v = path + count, *prev = path + count - 1;
+
+        float t_d;
+        if (!NextVertex(origin, direction, v, &beta, w, prng, matStack,
+                        matPos, &t_d, triangles, nodes, mapping, materials,
+                        volumes, grids))
+        {
+            *escaped = beta * SkyRadiance(direction, w, skyMap, sky);
+            break;
+        }
+
+        v->pdfFwd = pdf * fabs(v->incident.y) / (t_d * t_d);
+        v->pdfRev = 0.0f;
+        ++count;
+
+        if (v->emitter) break;
+
+        float4 weight;
+        float3 result = reflect(materials + v->in, materials + v->to, w,
+                                v->incident, prng, v->nested, &weight, &pdf);
+
+        /* The density of the previous vertex, were the subpath reversed. */
+        if (!v->delta)
+            prev->pdfRev = density(materials + v->in, materials + v->to, w,
+                                   -result, -v->incident, v->nested)
+                         * fabs(dot(prev->n, direction)) / (t_d * t_d);
+
+        /* Russian roulette, as in the main kernel. */
+        beta *= weight;
+        if (!Roulette(prng, &beta, start, depth++)) break;
+
+        direction = LeaveVertex(v, result, &origin, matStack, &matPos);
+    }
+
+    return count;
+}
+
+/** Connects a camera subpath vertex to a light subpath vertex.
+  * @param pt The camera subpath vertex, not on the lens.
+  * @param qs The light subpath vertex.
+  * @param light Whether \c qs is the light subpath's vertex on the light.
+  * @param w The light path's wavelengths, in meters.
+  * @param prng A PRNG instance.
+  * @param triangles The list of triangles in the scene.
+  * @param nodes The tree datastructure, as a list of nodes.
+  * @param materials The material table, indexed by material ID.
+  * @param volumes The density grid table, see volume.cl.
+  * @param grids The densities and majorants of all grids.
+  * @returns The light path's contribution at each wavelength, unweighted.
+**/
+float4 Connect(PathVertex *pt, PathVertex *qs, bool light, float4 w,
+               PRNG *prng, global Triangle *triangles, global Node *nodes,
+               constant Material *materials, constant Volume *volumes,
+               global float *grids)
+{
+    if (pt->emitter || pt->delta || qs->delta) return (float4)(0.0f);
+
+    float3 direction = qs->p - pt->p;
+    float distance = length(direction);
+    direction /= distance;
+
+    float4 fc = evaluate(materials + pt->in, materials + pt->to, w,
+                         pt->incident, VertexTBN(direction, pt), pt->nested);
+
+    /* Light sources emit the same radiance (in beta) on either side. */
+    float4 fl = light ? (float4)(fabs(dot(qs->n, direction)))
+                      : evaluate(materials + qs->in, materials + qs->to, w,
+                                 qs->incident, VertexTBN(-direction, qs),
+                                 qs->nested);
+
+    if (all(fc * fl == (float4)(0.0f))) return (float4)(0.0f);
+
+    /* Are the vertices visible from one another? */
+    float t_d; uint hit;
+    if (!Intersect(pt->p + pt->n * PSHBK, direction, &t_d, &hit,
+                   triangles, nodes) || (hit != qs->triangle))
+        return (float4)(0.0f);
+
+    float4 Tr = Transmittance(materials + pt->in, w, pt->p, direction,
+                              distance, prng, volumes, grids);
+    return pt->beta * fc * Tr * fl * qs->beta / (distance * distance);
+}
+
+/** Connects a light subpath vertex to a point on the camera's lens.
+  * @param qs The light subpath vertex, not on the light source.
+  * @param lens The point on the lens.
+  * @param w The light path's wavelengths, in meters.
+  * @param params The render parameters.
+  * @param camera The virtual camera parameters.
+  * @param coords A pointer in which to store the pixel the vertex lands on.
+  * @param cameraPdf A pointer in which to store the density (per solid
+  *                  angle) with which the camera samples the vertex.
+  * @param triangles The list of triangles in the scene.
+  * @param nodes The tree datastructure, as a list of nodes.
+  * @param materials The material table, indexed by material ID.
+  * @param volumes The density grid table, see volume.cl.
+  * @param grids The densities and majorants of all grids.
+  * @param prng A PRNG instance.
+  * @returns The light path's contribution at each wavelength, unweighted, to
+  *          be added to the pixel.
+**/
+float4 ConnectLens(PathVertex *qs, float3 lens, float4 w,
+                   constant Params *params, constant Camera *camera,
+                   uint2 *coords, float *cameraPdf,
+                   global Triangle *triangles, global Node *nodes,
+                   constant Material *materials, constant Volume *volumes,
+                   global float *grids, PRNG *prng)
+{
+    if (qs->delta) return (float4)(0.0f);
+
+    float3 direction = lens - qs->p;
+    float distance = length(direction);
+    direction /= distance;
+
+    *cameraPdf = CameraDensity(lens, -direction, params, camera, coords);
+    if (*cameraPdf == 0.0f) return (float4)(0.0f);
+
+    float4 fl = evaluate(materials + qs->in, materials + qs->to, w,
+                         qs->incident, VertexTBN(direction, qs), qs->nested);
+    if (all(fl == (float4)(0.0f))) return (float4)(0.0f);
+
+    /* Is the lens visible from the vertex? */
+    float t_d; uint hit;
+    if (Intersect(qs->p + qs->n * PSHBK, direction, &t_d, &hit,
+                  triangles, nodes) && (t_d < distance))
+        return (float4)(0.0f);
+
+    /* The camera's importance is its density, over the render. */
+    float4 Tr = Transmittance(materials + qs->in, w, qs->p, direction,
+                              distance, prng, volumes, grids);
+    return qs->beta * fl * Tr * (*cameraPdf) / (distance * distance);
+}
+
+/** Returns zero densities, which belong to delta vertices, as one. **/
+float Remap0(float pdf)
+{
+    return (pdf != 0.0f) ? pdf : 1.0f;
+}
+
+/** Returns the balance heuristic weight of a light path obtained by joining a
+  * camera subpath's first \c t vertices to a light subpath's first \c s ones,
+  * against every other split of the same path between the two subpaths.
+  * @param cam The camera subpath, of which the first vertex is on the lens.
+  * @param t The number of camera subpath vertices, at least one.
+  * @param lgt The light subpath, of which the first vertex is on a light.
+  * @param s The number of light subpath vertices.
+  * @param cameraPdf The density (per solid angle) with which the camera
+  *                  samples the last light subpath vertex, if \c t is one.
+  * @param lightArea The total area of the light sources.
+  * @param w The light path's wavelengths, in meters.
+  * @param materials The material table, indexed by material ID.
+  * @returns The light path's weight.
+  * @remarks The kernel never connects a light subpath's first vertex to the
+  *          lens (s = t = 1), so that strategy isn't counted against others.
+**/
+float MISWeight(PathVertex *cam, uint t, PathVertex *lgt, uint s,
+                float cameraPdf, float lightArea, float4 w,
+                constant Material *materials)
+{
+    /* The vertices on either side of the connection, and their predecessors. */
+    PathVertex *pt = cam + t - 1, *ptMinus = cam + max((int)t - 2, 0);
+    PathVertex *qs = lgt + max((int)s - 1, 0);
+    PathVertex *qsMinus = lgt + max((int)s - 2, 0);
+
+    /* Their reverse densities change with the connection, save them. */
+    float ptRev = pt->pdfRev, ptMinusRev = ptMinus->pdfRev;
+    float qsRev = qs->pdfRev, qsMinusRev = qsMinus->pdfRev;
+
+    if (s == 0)
+    {
+        /* The camera subpath hit a light source. */
+        pt->pdfRev = 1.0f / lightArea;
+        ptMinus->pdfRev = EmissionDensity(pt, ptMinus);
+    }
+    else if (t == 1)
+    {
+        /* The light subpath was connected to the lens. */
+        float3 direction = qs->p - pt->p;
+        qs->pdfRev = cameraPdf * fabs(dot(qs->n, normalize(direction)))
+                   / dot(direction, direction);
+        qsMinus->pdfRev = ScatterDensity(qs, pt->p, qsMinus, w, materials);
+    }
+    else
+    {
+        pt->pdfRev = (s == 1) ? EmissionDensity(qs, pt)
+                   : ScatterDensity(qs, qsMinus->p, pt, w, materials);
+        if (t > 2)
+            ptMinus->pdfRev = ScatterDensity(pt, qs->p, ptMinus, w, materials);
+        qs->pdfRev = ScatterDensity(pt, ptMinus->p, qs, w, materials);
+        if (s > 1)
+            qsMinus->pdfRev = ScatterDensity(qs, pt->p, qsMinus, w, materials);
+    }
+
+    /* Sum the ratios of the densities of every other strategy to this one's. */
+    float sum = 0.0f, r = 1.0f;
+
+    for (uint i = t - 1; i > 0; --i)
+    {
+        r *= Remap0(cam[i].pdfRev) / Remap0(cam[i].pdfFwd);
+        if ((i == 1) && (s + t == 2)) continue; /* Not sampled, see above. */
+        if (!cam[i].delta && !cam[i - 1].delta) sum += r;
+    }
+
+    r = 1.0f;
+    for (int i = (int)s - 1; i >= 0; --i)
+    {
+        r *= Remap0(lgt[i].pdfRev) / Remap0(lgt[i].pdfFwd);
+        if (!lgt[i].delta && ((i == 0) || !lgt[i - 1].delta)) sum += r;
+    }
+
+    pt->pdfRev = ptRev; ptMinus->pdfRev = ptMinusRev;
+    qs->pdfRev = qsRev; qsMinus->pdfRev = qsMinusRev;
+    return 1.0f / (1.0f + sum);
+}
+
+/** This is the BDPT kernel, which takes the same arguments as \c clmain, see
+  * there. In this mode, each work-item only adds the color (but not the sample
+  * count) of its pixels to the pixel buffer atomically, as the light tracing
+  * samples of other work-items may land on them. The light tree is not used.
+**/
+void kernel clbdpt(   global   float4        *buffer,
+                    constant   Params        *params,
+                      global   float        *moments,
+                      global   uint          *pixels,
+                      global   float4     *splitting,
+                    constant   float4      *spectrum,
+                      global   Triangle   *triangles,
+                      global   Node           *nodes,
+                      global   Light         *lights,
+                      global   LightNode  *lightTree,
+                                   uint        lightCount,
+                                   float        lightArea,
+                    constant   uint         *mapping,
+                    constant   Material   *materials,
+                    constant   Volume       *volumes,
+                      global   float          *grids,
+                      global   float4         *skyMap,
+                      global   float          *skyCdf,
+                    constant   Sky               *sky,
+                    constant   Camera        *camera,
+                    constant   ulong4          *seed,
+                                   uint             first,
+                                   uint             count,
+                      global   uint         *counter)
+{
+    /* Pixels assigned to this worker, persistent workers fetch their own. */
+    #ifdef KERNEL_MODE_PERSISTENT
+    uint next = 0, last = 0;
+    #else
+    uint next = GlobalID(), last = next + 1;
+    #endif
+
+    PathVertex cam[BDPT_VERTICES], lgt[BDPT_VERTICES];
+    uint pixel;
+    uint2 coords;
+
+    while (NextPixel(&pixel, &coords, &next, &last, counter, pixels, params))
+    {
+        float4 accumulated = (float4)(0.0f);
+
+        for (uint sample = 0; sample < count; ++sample)
+        {
+            /* Init PRNG for this sample of this pixel. */
+            PRNG prng = initPixel(pixel, coords, first + sample, seed);
+
+            /* Both subpaths share the camera sample's wavelengths. */
+            float4 w_pdf, u = rand(&prng) + (float4)(0.0f, 0.25f, 0.5f, 0.75f);
+            float4 wavelengths = SampleWavelengths(u - floor(u), spectrum,
+                                                   &w_pdf);
+            float4 w_m = (wavelengths * 400 + 380) * 1e-9f;
+
+            /* Trace the camera subpath, from the lens. */
+            float3 origin, direction;
+            uint2 unused;
+            CameraRay(coords, &prng, params, camera, &origin, &direction);
+
+            cam[0].p = origin;
+            cam[0].n = direction;
+            cam[0].beta = (float4)(1.0f);
+            cam[0].pdfFwd = 1.0f;
+            cam[0].pdfRev = 0.0f;
+            cam[0].delta = cam[0].emitter = false;
+
+            float4 radiance;
+            uint t = RandomWalk(origin, direction, (float4)(1.0f),
+                                CameraDensity(origin, direction, params,
+                                              camera, &unused),
+                                cam, 1, w_m, &prng, &radiance, triangles,
+                                nodes, mapping, materials, volumes, grids,
+                                skyMap, sky);
+
+            /* Trace the light subpath, from a point on a light source. */
+            uint s = 0;
+            if (lightCount > 0)
+            {
+                float cosine;
+                direction = EmitVertex(&prng, lgt, w_m, lights, lightCount,
+                                       lightArea, triangles, mapping,
+                                       materials, &cosine);
+
+                /* The throughput is Le.cos / (pdf(point).pdf(direction)). */
+                float4 escaped;
+                s = RandomWalk(lgt[0].p + lgt[0].n * PSHBK, direction,
+                               lgt[0].beta * 2 * PI, cosine / (2 * PI),
+                               lgt, 1, w_m, &prng, &escaped, triangles,
+                               nodes, mapping, materials, volumes, grids,
+                               skyMap, sky);
+            }
+
+            /* Connect every prefix of either subpath to the other. */
+            for (uint tt = 1; tt <= t; ++tt)
+                for (uint ss = 0; ss <= s; ++ss)
+                {
+                    /* The lens can't be connected to itself, nor to the *
+                     * light's own vertex (see MISWeight), skip these.    */
+                    if ((tt == 1) && (ss < 2)) continue;
+
+                    if (ss == 0)
+                    {
+                        /* The camera subpath hit a light source. */
+                        if (!cam[tt - 1].emitter) continue;
+
+                        float4 Le = exitant(materials + cam[tt - 1].matID, w_m,
+                                            cam[tt - 1].incident, &prng);
+                        radiance += cam[tt - 1].beta * fmax(Le, 0.0f)
+                                  * MISWeight(cam, tt, lgt, 0, 0.0f,
+                                              lightArea, w_m, materials);
+                    }
+                    else if (tt == 1)
+                    {
+                        /* Light tracing, through the camera sample's lens. */
+                        uint2 target; float cameraPdf;
+                        float4 c = ConnectLens(lgt + ss - 1, cam[0].p, w_m,
+                                               params, camera, &target,
+                                               &cameraPdf, triangles, nodes,
+                                               materials, volumes, grids,
+                                               &prng);
+                        if (all(c == (float4)(0.0f))) continue;
+
+                        c *= MISWeight(cam, 1, lgt, ss, cameraPdf,
+                                       lightArea, w_m, materials);
+
+                        Splat(buffer + target.y * RENDER_WIDTH + target.x,
+                              SpectralColor(wavelengths, c / w_pdf, spectrum)
+                              * 0.25f);
+                    }
+                    else
+                    {
+                        float4 c = Connect(cam + tt - 1, lgt + ss - 1, ss == 1,
+                                           w_m, &prng, triangles, nodes,
+                                           materials, volumes, grids);
+                        if (all(c == (float4)(0.0f))) continue;
+
+                        radiance += c * MISWeight(cam, tt, lgt, ss, 0.0f,
+                                                  lightArea, w_m, materials);
+                    }
+                }
+
+            float3 xyz = SpectralColor(wavelengths, radiance / w_pdf,
+                                       spectrum);
+            accumulated += (float4)(xyz * 0.25f, 1);
+        }
+
+        /* Only this work-item ever touches the pixel's sample count. */
+        Splat(buffer + pixel, accumulated.xyz);
+        ((global float *)(buffer + pixel))[3] += accumulated.w;
+    }
+}
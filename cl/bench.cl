@@ -0,0 +1,38 @@
+#pragma once
+
+#include <prng.cl>
+
+/** @file bench.cl
+  * @brief Sampler microbenchmark kernel.
+  *
+  * This kernel is not used for rendering, it only consumes random numbers the
+  * way light paths do, so that the renderer can compare the samplers selected
+  * by \c SAMPLER_SOBOL and \c SAMPLER_PHILOX (see prng.cl) on the device.
+**/
+
+/** Number of light paths traced by each work-item. **/
+#ifndef BENCH_PATHS
+#define BENCH_PATHS 16
+#endif
+
+/** Number of random numbers consumed by each light path. **/
+#ifndef BENCH_DIMENSIONS
+#define BENCH_DIMENSIONS 32
+#endif
+
+/** This is the benchmark kernel.
+  * @param seed The PRNG's seed.
+  * @param sink One float per work-item, such that no work can be skipped.
+**/
+void kernel clbench(constant ulong4 *seed, global float *sink)
+{
+    float sum = 0.0f;
+
+    for (uint path = 0; path < BENCH_PATHS; ++path)
+    {
+        PRNG prng = init(get_global_id(0), path, seed);
+        for (uint t = 0; t < BENCH_DIMENSIONS; ++t) sum += rand(&prng);
+    }
+
+    sink[get_global_id(0)] = sum;
+}
@@ -24,6 +24,11 @@ typedef struct Camera
     float spread;
 } Camera;
 
+#ifdef SCENE_CAMERA
+/** The camera parameters, when they are baked into a specialized kernel. **/
+constant Camera sceneCamera = SCENE_CAMERA;
+#endif
+
 /** Computes a camera ray for a given pixel.
   * @param u The normalized x-coordinate.
   * @param v The normalized y-coordinate.
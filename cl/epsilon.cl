@@ -11,248 +11,1236 @@
 #include <noaccel.cl>
 #endif
 
+/* This mode is enabled by the renderer (see the SortShading engine option). *
+ * The work-items of each work-group exchange their surface interactions via *
+ * local memory, sorted by material model, before shading them, so that each *
+ * work-item shades the same model as its neighbours, and the switch over    *
+ * the models in material.cl no longer diverges within a wavefront/warp.     */
+//#define KERNEL_MODE_SORTED
+
+/* This mode is enabled by the renderer (see the Persistent engine option). *
+ * Only enough work-items to fill the device are launched, and they fetch   *
+ * batches of pixels from a global counter until all pixels are rendered,  *
+ * so that long light paths no longer hold entire work-groups back.        */
+//#define KERNEL_MODE_PERSISTENT
+
+/* This mode is enabled by the renderer (see the Dispatch2D engine option). *
+ * The kernel is launched over a 2D range covering the render, and pixels  *
+ * are directly given by the global ID's, work-groups being pixel blocks.  *
+ * This has no effect in persistent mode, which always fetches row-major.  */
+//#define KERNEL_MODE_2D
+
+/* This mode is enabled by the renderer (see the AdaptiveInterval engine   *
+ * option). The second moment of each pixel's luminance is accumulated and *
+ * every few launches, the pixels which haven't converged yet are listed   *
+ * by clconverge, then the kernel only renders the pixels in that list.    *
+ * The renderer never launches the kernel over a 2D range in this mode.    */
+//#define KERNEL_MODE_ADAPTIVE
+
+/* This mode is enabled by the renderer (see the SortRays engine option).   *
+ * Before each intersection step, the work-items of each work-group sort   *
+ * their rays by direction octant and origin cell, and trace each other's *
+ * rays in that order, so that neighbouring work-items traverse the same  *
+ * BVH nodes. This has no effect in NOACCEL mode, which has no BVH.       */
+//#define KERNEL_MODE_RAYSORT
+
+/* This mode is enabled by the renderer (see the NextEvent engine option).  *
+ * At every diffuse surface interaction, a point is sampled on the light    *
+ * sources and, if it is visible, the light it reflects is added directly   *
+ * (next-event estimation), and likewise for a direction towards the sky. *
+ * Light sources or sky hit right after a diffuse reflection were then     *
+ * sampled both ways, so both are weighted by multiple importance sampling,*
+ * using the power heuristic.                                              */
+//#define KERNEL_MODE_NEE
+
+/* This mode is enabled by the renderer (see the LightTree engine option).  *
+ * Light sources are sampled through the light tree, by their estimated     *
+ * contribution to the interaction, rather than by area, which saves most  *
+ * shadow rays in scenes with many light sources. It needs NEE to matter.  */
+//#define KERNEL_MODE_LIGHTTREE
+
+/* This mode is enabled by the renderer (see the MaxSplit engine option).   *
+ * Light paths split into several branches at their first diffuse vertex,  *
+ * traced one after the other, each carrying its share of the throughput. *
+ * The number of branches is chosen for each pixel from the variance of   *
+ * its samples and the cost of their paths before and after the vertex.   */
+//#define KERNEL_MODE_SPLIT
+
+/* This mode is enabled by the renderer (see the Accumulation engine option). *
+ * The pixel buffer holds each pixel's mean color and sample count as halves, *
+ * rather than their sums as floats, so it takes half the memory. They only   *
+ * cover the samples since the renderer last added them to its own buffer    *
+ * and reset them, which it does every few launches, so they stay accurate.  */
+//#define KERNEL_MODE_HALF
+
+/* This mode is enabled by the renderer (see the Integrator engine option). *
+ * The renderer launches clbdpt from bdpt.cl instead of clmain, which does *
+ * bidirectional path tracing, and adds the samples of light paths traced  *
+ * from the light sources to whichever pixel they land on, atomically.     */
+//#define KERNEL_MODE_BDPT
+
+/* This mode is enabled by the renderer (see the Integrator engine option). *
+ * The renderer launches clsppm from sppm.cl instead of clmain, three times *
+ * per pass, which does stochastic progressive photon mapping: each pass    *
+ * traces camera paths to diffuse surfaces, then photons from the light     *
+ * sources, which are gathered by the nearby camera paths' surfaces.        */
+//#define KERNEL_MODE_SPPM
+
+/* This is set by the renderer (see the TileSize engine option). When it is  *
+ * nonzero, pixel indices are mapped to square tiles of this many pixels per *
+ * side, traversed in Morton order, so that each work-group or batch covers *
+ * a compact block of pixels instead of a strip. It must be a power of two. */
+#ifndef TILE_SIZE
+#define TILE_SIZE 0
+#endif
+
+/* The NOACCEL scene has its own materials, and doesn't use the BVH. */
+#ifdef KERNEL_MODE_NOACCEL
+#undef KERNEL_MODE_RAYSORT
+#undef KERNEL_MODE_NEE
+#undef KERNEL_MODE_LIGHTTREE
+#undef SCENE_MODELS
+#undef MT
+#endif
+
+/* These modes need the whole work-group to go through the kernel's loop in *
+ * lockstep, as they exchange data between work-items at every iteration.  */
+#if defined(KERNEL_MODE_SORTED) || defined(KERNEL_MODE_RAYSORT)
+#define KERNEL_GROUP_UNIFORM
+#endif
+
 #include <material.cl>
+#include <volume.cl>
 #include <camera.cl>
 #include <prng.cl>
 #include <util.cl>
+#include <sort.cl>
 #include <bvh.cl>
+#include <light.cl>
+#include <sky.cl>
+#include <spectral.cl>
 
 /** @file epsilon.cl
   * @brief Rendering kernel.
 **/
 
 /** Maximum number of nested materials, setting this value too high will cause 
-  * register pressure and will slow down the rendering.
+  * register pressure and will slow down the rendering. When the kernel is
+  * specialized, the renderer sets it to what the scene actually needs.
 **/
+#ifndef MT
 #define MT 4
+#endif
 
 typedef struct Params
 {
     uint width, height;
 } Params;
 
-/* Image sampler, using texel linear interpolation. */
-constant sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE |
-                             CLK_ADDRESS_CLAMP_TO_EDGE  |
-                             CLK_FILTER_LINEAR;
+/** The render's resolution, which is a compile-time constant if the kernel is
+  * specialized, and is otherwise read from the render parameters (these must
+  * then be available as \c params in the enclosing scope).
+**/
+#ifdef SCENE_WIDTH
+#define RENDER_WIDTH SCENE_WIDTH
+#define RENDER_HEIGHT SCENE_HEIGHT
+#else
+#define RENDER_WIDTH (params->width)
+#define RENDER_HEIGHT (params->height)
+#endif
+
+/** Number of pixels fetched at once from the work counter in persistent mode,
+  * larger batches reduce contention on the counter but balance less evenly.
+**/
+#ifndef PERSISTENT_BATCH
+#define PERSISTENT_BATCH 4
+#endif
+
+/** Returns the number of pixel indices to be processed for a render, which
+  * includes those which fall outside of it, if the last tiles are partial.
+  * @param params The render parameters.
+  * @returns The number of pixel indices.
+**/
+uint PixelSlots(constant Params *params)
+{
+    #if TILE_SIZE > 0
+    uint tilesX = (RENDER_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+    uint tilesY = (RENDER_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+    return tilesX * tilesY * TILE_SIZE * TILE_SIZE;
+    #else
+    return RENDER_WIDTH * RENDER_HEIGHT;
+    #endif
+}
+
+/** Maps a pixel index to the coordinates of the pixel.
+  * @param index The pixel index, less than \c PixelSlots.
+  * @param params The render parameters.
+  * @returns The pixel's coordinates, possibly outside of the render.
+**/
+uint2 PixelCoords(uint index, constant Params *params)
+{
+    #if TILE_SIZE > 0
+    uint tile = index / (TILE_SIZE * TILE_SIZE);
+    uint tilesX = (RENDER_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+    uint2 origin = (uint2)(tile % tilesX, tile / tilesX) * TILE_SIZE;
+    return origin + Morton(index % (TILE_SIZE * TILE_SIZE));
+    #else
+    return (uint2)(index % RENDER_WIDTH, index / RENDER_WIDTH);
+    #endif
+}
+
+/** Fetches the next pixel a work-item is to render.
+  * @param pixel A pointer to a \c uint in which to store the pixel index.
+  * @param coords A pointer in which to store the pixel's coordinates.
+  * @param next A pointer to the next pixel of the work-item's current batch.
+  * @param last A pointer to the end of the work-item's current batch.
+  * @param counter The global work counter (only used in persistent mode).
+  * @param active The list of pixels to render (only used in adaptive mode).
+  * @param params The render parameters.
+  * @returns Whether a pixel was fetched, if this is \c false, the work-item
+  *          has no work left for this pass. Work-items beyond the edges of
+  *          the render (as the launch is padded) never get any pixels.
+**/
+bool NextPixel(uint *pixel, uint2 *coords, uint *next, uint *last,
+               global uint *counter, global uint *active,
+               constant Params *params)
+{
+    /* Skip over indices outside of the render, due to partial tiles. */
+    while (true)
+    {
+        #ifdef KERNEL_MODE_PERSISTENT
+        /* Grab a new batch of pixels when the current one runs out. */
+        if (*next == *last)
+        {
+            *next = atomic_add(counter, PERSISTENT_BATCH);
+            *last = *next + PERSISTENT_BATCH;
+        }
+        #endif
+
+        if (*next == *last) return false;
+        uint index = (*next)++;
+
+        #if defined(KERNEL_MODE_ADAPTIVE)
+        /* The first entry of the list is its length. */
+        if (index >= active[0]) return false;
+        uint2 c = PixelCoords(active[1 + index], params);
+        #elif defined(KERNEL_MODE_2D) && !defined(KERNEL_MODE_PERSISTENT)
+        uint2 c = (uint2)(get_global_id(0), get_global_id(1));
+        #else
+        if (index >= PixelSlots(params)) return false;
+        uint2 c = PixelCoords(index, params);
+        #endif
+
+        if ((c.x < RENDER_WIDTH) && (c.y < RENDER_HEIGHT))
+        {
+            *pixel = c.y * RENDER_WIDTH + c.x;
+            *coords = c;
+            return true;
+        }
+    }
+}
+
+/** @brief The largest finite half. **/
+#define HALF_LARGEST 65504.0f
+
+/** Adds the samples of a pixel to the pixel buffer.
+  * @param buffer The pixel buffer, which holds halves in \c KERNEL_MODE_HALF.
+  * @param pixel The pixel.
+  * @param samples The sum of the samples' colors, and their number.
+  * @remarks With halves, the pixel's mean color is scaled down, keeping its
+  *          hue, until it fits within the largest finite half, so that one
+  *          very bright sample (such as one directly seeing the sun) can't
+  *          make it infinite, and the pixel with it once flushed. Such a
+  *          pixel is darkened a little instead.
+**/
+void AccumulatePixel(global float4 *buffer, uint pixel, float4 samples)
+{
+    #ifdef KERNEL_MODE_HALF
+    /* Fold the samples into the pixel's mean, which unlike the sum of the *
+     * samples doesn't grow past what halves can represent.                */
+    global half *pixels = (global half *)buffer;
+    float4 mean = vload_half4(pixel, pixels);
+    float count = mean.w + samples.w;
+    float3 color = (mean.xyz * mean.w + samples.xyz) / count;
+
+    float peak = max(max(fabs(color.x), fabs(color.y)), fabs(color.z));
+    if (!(peak <= HALF_LARGEST)) color *= HALF_LARGEST / peak;
+
+    vstore_half4((float4)(color, count), pixel, pixels);
+    #else
+    buffer[pixel] += samples;
+    #endif
+}
+
+/** Lists the pixels which haven't converged yet, the relative error of their
+  * mean luminance being still above a threshold, for the next launches. This
+  * kernel is launched over all pixel indices, after setting the length of the
+  * list, its first entry, to zero.
+  * @param buffer The pixel buffer, as a flat 2D array.
+  * @param params The render parameters.
+  * @param moments The second moment of each pixel's luminance.
+  * @param active The list of pixels to render, see \c NextPixel.
+  * @param threshold The relative error below which pixels have converged.
+  * @param minSamples The number of samples below which pixels haven't.
+**/
+void kernel clconverge(global float4 *buffer, constant Params *params,
+                       global float *moments, global uint *active,
+                       float threshold, uint minSamples)
+{
+    uint index = get_global_id(0);
+    if (index >= PixelSlots(params)) return;
+
+    uint2 c = PixelCoords(index, params);
+    if ((c.x >= RENDER_WIDTH) || (c.y >= RENDER_HEIGHT)) return;
+    uint pixel = c.y * RENDER_WIDTH + c.x;
+
+    /* Unbiased variance of the luminance, from its first two moments. */
+    float n = buffer[pixel].w;
+    float mean = buffer[pixel].y / n;
+    float variance = (moments[pixel] / n - mean * mean) * n / (n - 1);
+
+    /* The variance of the mean is the variance over the sample count. A *
+     * black pixel may just not have found its light yet (e.g. caustics). */
+    bool converged = (n >= minSamples) && (mean > 0.0f)
+                  && (variance <= threshold * threshold * mean * mean * n);
+    if (!converged) active[1 + atomic_inc(active)] = index;
+}
+
+/** Number of cells per axis of the grid used to quantize ray origins. **/
+#define RAY_KEY_CELLS 8
+
+/** Number of bits of the Morton code of the origin's cell in the keys, the
+  * finest of its nine bits being dropped, so that the keys are sorted in one
+  * radix sort pass fewer.
+**/
+#define RAY_KEY_CELL_BITS 8
+
+/** Number of significant bits in the keys returned by \c RayKey, the octant
+  * taking the last radix digit, whose next value is left for inactive rays.
+**/
+#define RAY_KEY_BITS (RAY_KEY_CELL_BITS + SORT_RADIX_BITS)
+
+/** Computes the key by which rays are sorted before being traced, rays with
+  * close keys should visit mostly the same BVH nodes.
+  * @param active Whether the ray is to be traced at all.
+  * @param origin The ray's origin.
+  * @param direction The ray's direction.
+  * @param nodes The BVH nodes, the first of which bounds the whole scene.
+  * @returns The key, from the ray's direction octant in the upper bits and
+  *          the Morton code of its origin's cell (in the scene's bounding
+  *          box) in the lower bits. Inactive rays sort after active ones.
+**/
+uint RayKey(bool active, float3 origin, float3 direction, global Node *nodes)
+{
+    if (!active) return 8 << RAY_KEY_CELL_BITS;
+
+    float3 bmin = nodes[0].min.xyz, bmax = nodes[0].max.xyz;
+    float3 cell = (origin - bmin) / fmax(bmax - bmin, (float3)(1e-6f));
+    uint3 c = convert_uint3(clamp(cell, 0.0f, 0.999f) * RAY_KEY_CELLS);
+
+    uint octant = (direction.x < 0) | ((direction.y < 0) << 1)
+                                    | ((direction.z < 0) << 2);
+
+    return (octant << RAY_KEY_CELL_BITS) | (Morton3D(c) >> 1);
+}
+
+/** Generates a jittered camera ray through a given pixel.
+  * @param coords The pixel's coordinates.
+  * @param prng A PRNG instance.
+  * @param params The render parameters.
+  * @param camera The virtual camera parameters.
+  * @param origin A pointer to the camera ray's origin.
+  * @param direction A pointer to the camera ray's direction.
+**/
+void CameraRay(uint2 coords, PRNG *prng, constant Params *params,
+               constant Camera *camera, float3 *origin, float3 *direction)
+{
+    /* Jitter for antialiasing. */
+    float a1 = rand(prng) - 0.5f;
+    float a2 = rand(prng) - 0.5f;
+
+    /* Obtain normalized pixel coordinates between 0 and 1 excl. */
+    float x = (float)(a1 + coords.x) /  RENDER_WIDTH;
+    float y = (float)(a2 + coords.y) / RENDER_HEIGHT;
+
+    /* Aspect ratio correction, prefers widescreen... */
+    float ratio = (float)RENDER_WIDTH / RENDER_HEIGHT;
+    x = 0.5f * (1 + ratio) - x * ratio;
+
+    #ifdef KERNEL_MODE_NOACCEL
+    /* Trace camera ray with sphere scene. */
+    NoAccel_Trace(x, y, origin, direction);
+    #else
+    #ifdef SCENE_CAMERA
+    /* Use the camera parameters baked into the kernel. */
+    camera = &sceneCamera;
+    #endif
+
+    /* Compute the camera ray from the normalized pixel coordinates. */
+    Trace(x, y, origin, direction, rand(prng), rand(prng), camera);
+    #endif
+}
+
+/** The number of bounces after which light paths may be terminated by Russian
+  * roulette, this is set by the renderer (see the RouletteDepth engine option).
+**/
+#ifndef RR_DEPTH
+#define RR_DEPTH 3
+#endif
+
+/** Plays Russian roulette with a light path, after \c RR_DEPTH bounces, with
+  * a survival probability given by its throughput relative to the one it had
+  * at the start, so that paths which still carry a lot of light go on, while
+  * those which lost most of it are terminated early.
+  * @param prng A PRNG instance.
+  * @param throughput A pointer to the light path's throughput, which is
+  *                   divided by the survival probability, if it survives.
+  * @param start The largest component of the throughput it started with.
+  * @param depth The number of bounces of the light path so far.
+  * @returns Whether the light path survives.
+**/
+bool Roulette(PRNG *prng, float4 *throughput, float start, uint depth)
+{
+    float m = max(max(throughput->x, throughput->y),
+                  max(throughput->z, throughput->w));
+
+    if (!(m > 0.0f)) return false;
+    if (depth < RR_DEPTH) return true;
+
+    float p = min(m / start, 1.0f);
+    if (rand(prng) >= p) return false;
+
+    *throughput /= p;
+    return true;
+}
+
+#ifdef KERNEL_MODE_SPLIT
+/** Number of samples a pixel needs before its light paths are split. **/
+#define SPLIT_WARMUP 16
+
+/** Chooses how many branches the light paths through a pixel split into, as
+  * the square root of the relative variance of its samples times the ratio of
+  * the cost of their paths up to the split to that of each branch, which is
+  * the factor which maximizes efficiency if the variance is all due to what
+  * happens after the split. This is then at most \c SPLIT_MAX.
+  * @param pixel The pixel, the y-component being the sum of its luminance.
+  * @param stats The pixel's splitting statistics, the sum of the squared
+  *              luminance of its samples, the number of split samples, and
+  *              the sum of the lengths of their paths before the split, and
+  *              of the average length of their branches after it.
+  * @returns The number of branches, at least one.
+**/
+uint SplitFactor(float4 pixel, float4 stats)
+{
+    if ((pixel.w < SPLIT_WARMUP) || (pixel.y <= 0.0f) || (stats.y == 0.0f))
+        return 1;
+
+    float mean = pixel.y / pixel.w;
+    float variance = fmax(stats.x / pixel.w - mean * mean, 0.0f);
+    float cost = stats.z / stats.w;
+
+    float factor = sqrt(variance / (mean * mean) * cost);
+    return (uint)clamp(factor + 0.5f, 1.0f, (float)SPLIT_MAX);
+}
+#endif
+
+#ifdef KERNEL_MODE_NEE
+/** Returns the power heuristic weight of a sample from one of two strategies.
+  * @param pdf The density of the sample, with the strategy which produced it.
+  * @param other The density of the sample, with the other strategy.
+  * @returns The sample's weight.
+**/
+float PowerHeuristic(float pdf, float other)
+{
+    return (pdf * pdf) / (pdf * pdf + other * other);
+}
+
+/** Returns the density (per unit area) with which a point on an emissive
+  * triangle is sampled by \c DirectLight, from a given interaction.
+  * @param light The emissive triangle's index.
+  * @param origin The interaction's location, pushed back off the surface.
+  * @param triangles The list of triangles in the scene.
+  * @param lightTree The light tree.
+  * @param lightArea The total area of the light sources.
+  * @returns The density of the point.
+**/
+float LightAreaDensity(uint light, float3 origin, global Triangle *triangles,
+                       global LightNode *lightTree, float lightArea)
+{
+    #ifdef KERNEL_MODE_LIGHTTREE
+    return LightTreeProbability(triangles[light].light, lightTree, origin)
+         / TriangleArea(triangles + light);
+    #else
+    return 1.0f / lightArea;
+    #endif
+}
+
+/** Returns the density (per solid angle) of a point on the light sources, as
+  * seen from a given distance.
+  * @param distance The distance to the point.
+  * @param cosine The cosine of the ray with the light source's normal.
+  * @param areaPdf The density of the point per unit area.
+  * @returns The density of the point.
+**/
+float LightDensity(float distance, float cosine, float areaPdf)
+{
+    return distance * distance * areaPdf / cosine;
+}
+
+/** Estimates the light reflected by a diffuse surface interaction coming from
+  * the light sources directly, by sampling a point on them.
+  * @param interaction The surface interaction.
+  * @param origin The interaction's location, pushed back off the surface.
+  * @param v_b The interaction's bitangent.
+  * @param v_n The interaction's normal, on the side of the incident ray.
+  * @param v_t The interaction's tangent.
+  * @param prng A PRNG instance.
+  * @param triangles The list of triangles in the scene.
+  * @param nodes The tree datastructure, as a list of nodes.
+  * @param lights The light list.
+  * @param lightTree The light tree.
+  * @param lightCount The number of entries in the light list.
+  * @param lightArea The total area of the light sources.
+  * @param mapping The model to material mapping.
+  * @param materials The material table, indexed by material ID.
+  * @param volumes The density grid table, see volume.cl.
+  * @param grids The densities and majorants of all grids.
+  * @returns The reflected radiance at each wavelength, to be multiplied with
+  *          the path's throughput, weighted against sampling the reflection.
+**/
+float4 DirectLight(Interaction interaction, float3 origin,
+                   float3 v_b, float3 v_n, float3 v_t, PRNG *prng,
+                   global Triangle *triangles, global Node *nodes,
+                   global Light *lights, global LightNode *lightTree,
+                   uint lightCount, float lightArea,
+                   constant uint *mapping, constant Material *materials,
+                   constant Volume *volumes, global float *grids)
+{
+    if (lightCount == 0) return (float4)(0.0f);
+
+    #ifdef KERNEL_MODE_LIGHTTREE
+    float probability;
+    uint light = SampleLightTree(prng, lightTree, origin, &probability);
+    if (probability == 0.0f) return (float4)(0.0f);
+    float3 point = SampleTriangle(prng, triangles + light);
+    float areaPdf = probability / TriangleArea(triangles + light);
+    #else
+    float3 point;
+    uint light = SampleLight(prng, lights, lightCount, triangles, &point);
+    float areaPdf = 1.0f / lightArea;
+    #endif
+
+    float3 direction = point - origin;
+    float distance = length(direction);
+    direction /= distance;
+
+    /* Evaluate the reflectance towards the light, in TBN space. */
+    float3 reflected = (float3)(dot(direction, v_b),
+                                dot(direction, v_n),
+                                dot(direction, v_t));
+
+    float4 f = evaluate(materials + interaction.in, materials + interaction.to,
+                        interaction.wavelengths, interaction.incident.xyz,
+                        reflected, interaction.nested);
+
+    float cosL = fabs(dot(direction, triangles[light].n));
+    if (all(f == (float4)(0.0f)) || (cosL == 0.0f)) return (float4)(0.0f);
+
+    /* Is the point visible from the interaction? */
+    float t_d; uint hit;
+    if (!Intersect(origin, direction, &t_d, &hit, triangles, nodes)
+     || (hit != light)) return (float4)(0.0f);
+
+    constant Material *emitter = materials + mapping[triangles[light].mat];
+    float4 Le = exitant(emitter, interaction.wavelengths, reflected, prng);
+
+    /* Weight this against sampling the point by reflection. */
+    float lightPdf = LightDensity(distance, cosL, areaPdf);
+    float bsdfPdf = density(materials + interaction.in,
+                            materials + interaction.to,
+                            interaction.wavelengths, interaction.incident.xyz,
+                            reflected, interaction.nested);
+
+    /* Account for the medium the shadow ray goes through. */
+    float4 Tr = Transmittance(materials + interaction.in,
+                              interaction.wavelengths, origin, direction,
+                              distance, prng, volumes, grids);
+    return f * fmax(Le, 0.0f) * Tr * PowerHeuristic(lightPdf, bsdfPdf)
+         / lightPdf;
+}
+
+/** Estimates the light reflected by a diffuse surface interaction coming from
+  * the sky directly, by sampling a direction towards it.
+  * @param interaction The surface interaction.
+  * @param origin The interaction's location, pushed back off the surface.
+  * @param v_b The interaction's bitangent.
+  * @param v_n The interaction's normal, on the side of the incident ray.
+  * @param v_t The interaction's tangent.
+  * @param prng A PRNG instance.
+  * @param triangles The list of triangles in the scene.
+  * @param nodes The tree datastructure, as a list of nodes.
+  * @param skyMap The sky map.
+  * @param skyCdf The sky map's cumulative distributions.
+  * @param sky The sky parameters.
+  * @param materials The material table, indexed by material ID.
+  * @param volumes The density grid table, see volume.cl.
+  * @param grids The densities and majorants of all grids.
+  * @returns The reflected radiance at each wavelength, to be multiplied with
+  *          the path's throughput, weighted against sampling the reflection.
+**/
+float4 DirectSky(Interaction interaction, float3 origin,
+                 float3 v_b, float3 v_n, float3 v_t, PRNG *prng,
+                 global Triangle *triangles, global Node *nodes,
+                 global float4 *skyMap, global float *skyCdf,
+                 constant Sky *sky, constant Material *materials,
+                 constant Volume *volumes, global float *grids)
+{
+    if (sky->width == 0) return (float4)(0.0f);
+
+    float skyPdf;
+    float3 direction = SampleSky(prng, skyMap, skyCdf, sky, &skyPdf);
+    if (skyPdf == 0.0f) return (float4)(0.0f);
+
+    /* Evaluate the reflectance towards the sky, in TBN space. */
+    float3 reflected = (float3)(dot(direction, v_b),
+                                dot(direction, v_n),
+                                dot(direction, v_t));
+
+    float4 f = evaluate(materials + interaction.in, materials + interaction.to,
+                        interaction.wavelengths, interaction.incident.xyz,
+                        reflected, interaction.nested);
+    if (all(f == (float4)(0.0f))) return (float4)(0.0f);
+
+    /* Is the sky visible from the interaction? */
+    float t_d; uint hit;
+    if (Intersect(origin, direction, &t_d, &hit, triangles, nodes))
+        return (float4)(0.0f);
+
+    float4 Le = SkyRadiance(direction, interaction.wavelengths, skyMap, sky);
+
+    /* Weight this against sampling the direction by reflection. */
+    float bsdfPdf = density(materials + interaction.in,
+                            materials + interaction.to,
+                            interaction.wavelengths, interaction.incident.xyz,
+                            reflected, interaction.nested);
+
+    /* Escaped rays are only attenuated by density grids, as in clmain. */
+    if (heterogeneous(materials + interaction.in))
+        Le *= Transmittance(materials + interaction.in,
+                            interaction.wavelengths, origin, direction,
+                            INFINITY, prng, volumes, grids);
+
+    return f * Le * PowerHeuristic(skyPdf, bsdfPdf) / skyPdf;
+}
+#endif
 
 /** This is the main kernel, which performs the entire ray tracing step.
   * @param buffer The pixel buffer, as a flat 2D array.
   * @param params The render parameters (render width and height).
-  * @param spectrum The tristimulus curve, to map wavelengths to colors.
+  * @param moments The second moment of each pixel's luminance, accumulated
+  *                in adaptive mode only.
+  * @param pixels The list of pixels to render, in adaptive mode only.
+  * @param splitting The splitting statistics of each pixel (see \c
+  *                  SplitFactor), accumulated in splitting mode only.
+  * @param spectrum The tristimulus curve, to map wavelengths to colors, along
+  *                 with the wavelength sampling distribution.
   * @param triangles The list of triangles in the scene.
   * @param nodes The tree datastructure, as a list of nodes.
+  * @param lights The light list, see light.cl.
+  * @param lightTree The light tree, see light.cl.
+  * @param lightCount The number of entries in the light list.
+  * @param lightArea The total area of the light sources.
   * @param mapping The model to material mapping.
+  * @param materials The material table, indexed by material ID.
+  * @param volumes The density grid table, see volume.cl.
+  * @param grids The densities and majorants of all grids.
+  * @param skyMap The sky map, see sky.cl.
+  * @param skyCdf The sky map's cumulative distributions.
+  * @param sky The sky parameters.
   * @param camera The virtual camera parameters.
   * @param seed The PRNG's seed.
+  * @param first The index of the first sample rendered by this launch.
+  * @param count The number of samples per pixel rendered by this launch.
+  * @param counter The work counter, for persistent mode.
 **/
 void kernel clmain(   global   float4        *buffer, 
                     constant   Params        *params,
-                   read_only   image2d_t    spectrum, 
+                      global   float        *moments,
+                      global   uint          *pixels,
+                      global   float4     *splitting,
+                    constant   float4      *spectrum,
                       global   Triangle   *triangles, 
                       global   Node           *nodes,
+                      global   Light         *lights,
+                      global   LightNode  *lightTree,
+                                   uint        lightCount,
+                                   float        lightArea,
                     constant   uint         *mapping,
+                    constant   Material   *materials,
+                    constant   Volume       *volumes,
+                      global   float          *grids,
+                      global   float4         *skyMap,
+                      global   float          *skyCdf,
+                    constant   Sky               *sky,
                     constant   Camera        *camera,
-                    constant   ulong4          *seed)
+                    constant   ulong4          *seed,
+                                   uint             first,
+                                   uint             count,
+                      global   uint         *counter)
 {
-    /* Init PRNG for this worker. */
-    size_t index = get_global_id(0);
-    PRNG prng = init(index, seed);
-
-    /* Jitter for antialiasing. */
-    float a1 = rand(&prng) - 0.5f;
-    float a2 = rand(&prng) - 0.5f;
-    
-    /* Obtain normalized pixel coordinates between 0 and 1 excl. */
-    float x = (float)(a1 + index % params->width) /  params->width;
-    float y = (float)(a2 + index / params->width) / params->height;
+    #ifdef KERNEL_GROUP_UNIFORM
+    /* Local memory used to sort and synchronize the work-group. */
+    local uint4 sortKeys[LOCAL_SIZE_MAX];
+    local uint sortBins[SORT_BINS], alive;
+    uint lid = LocalID();
+    #endif
 
-    /* Aspect ratio correction, prefers widescreen... */
-    float ratio = (float)params->width / params->height;
-    x = 0.5f * (1 + ratio) - x * ratio;
+    #ifdef KERNEL_MODE_SORTED
+    /* Local memory used to bin surface interactions by material model. */
+    local Interaction interactions[LOCAL_SIZE_MAX];
+    local float4 shaded[LOCAL_SIZE_MAX], shadedWeights[LOCAL_SIZE_MAX];
+    local PRNG shadedPRNGs[LOCAL_SIZE_MAX];
+    #endif
 
-    /* The ray as vectors. */
-    float3 origin, direction;
+    #ifdef KERNEL_MODE_RAYSORT
+    /* Local memory used to exchange sorted rays and their intersections. */
+    local float4 rayOrigins[LOCAL_SIZE_MAX], rayDirections[LOCAL_SIZE_MAX];
+    local float rayDistances[LOCAL_SIZE_MAX];
+    local uint rayHits[LOCAL_SIZE_MAX];
+    #endif
 
-    #ifdef KERNEL_MODE_NOACCEL
-    /* Trace camera ray with sphere scene. */
-    NoAccel_Trace(x, y, &origin, &direction);
+    /* Pixels assigned to this worker, persistent workers fetch their own. */
+    uint pixelCount = RENDER_WIDTH * RENDER_HEIGHT;
+    #ifdef KERNEL_MODE_PERSISTENT
+    uint next = 0, last = 0;
     #else
-    /* Compute the camera ray from the normalized pixel coordinates. */
-    Trace(x, y, &origin, &direction, rand(&prng), rand(&prng), camera);
+    uint next = GlobalID(), last = next + 1;
     #endif
 
+    /* Light path state, the PRNG is reinitialized for each sample but might *
+     * be used for shading before that, so give it an ID no pixel can use.  */
+    PRNG prng = init(pixelCount + GlobalID(), first, seed);
+    uint pixel, sample = count;
+    uint2 coords;
+    float4 accumulated = (float4)(0.0f);
+    float moment = 0.0f;
+    float3 origin, direction;
+
+    /* The light path's wavelengths, normalized and in meters, the first one *
+     * being the hero wavelength, their densities, and the light path's     *
+     * throughput at each of them.                                          */
+    float4 wavelengths, w_m, w_pdf;
+    float4 throughput = (float4)(1.0f), radiance = (float4)(0.0f);
+
+    /* The density of the last reflected ray if light sources were sampled *
+     * from the last interaction, so light sources hit by the light path   *
+     * must be weighted against that, and zero otherwise.                  */
+    float bsdfPdf = 0.0f;
+
+    /* Where the light sources were sampled from, for the above weighting. */
+    float3 lastVertex = (float3)(0.0f);
+
     /* Media stack. */
     uint matStack[MT];
     uint matPos = 0;
 
-    #ifdef KERNEL_MODE_NOACCEL
-    /* Use the scene's atmosphere. */
-    matStack[0] = NOACCEL_ATMOSPHERE;
+    /* The number of bounces of the light path so far. */
+    uint depth = 0;
+
+    #ifdef KERNEL_MODE_SPLIT
+    /* The light path's state at its first diffuse vertex, where it splits, *
+     * and how many of its branches were traced, out of how many.           */
+    Interaction split;
+    float3 splitOrigin, split_b, split_n, split_t;
+    float4 splitThroughput;
+    uint splitStack[MT], splitPos, splitDepth;
+    uint branch = 0, branches = 0, splitFactor = 1;
+    bool resumed = false;
+
+    /* Splitting statistics of the samples of this pixel, see SplitFactor. */
+    float4 splitStats = (float4)(0.0f);
+    #endif
+
+    /* Whether a light path is being traced, and if there may be more work. */
+    bool active = false, working = true;
+
+    #ifdef KERNEL_GROUP_UNIFORM
+    /* The whole work-group keeps going until all light paths are complete. */
+    while (GroupAny(active || working, &alive))
     #else
-    /* Atmospheric medium. */
-    matStack[0] = mapping[0];
+    while (active || working)
     #endif
+    {
+        /* Start a new light path if the previous one is complete. */
+        if (!active && working)
+        {
+            /* Move on to the next pixel once this one has all its samples. */
+            if (sample == count)
+            {
+                working = NextPixel(&pixel, &coords, &next, &last,
+                                    counter, pixels, params);
+                sample = 0;
 
-    /* Select random wavelength. */
-    float wavelength = rand(&prng);
+                #ifdef KERNEL_MODE_SPLIT
+                if (working)
+                    splitFactor = SplitFactor(buffer[pixel], splitting[pixel]);
+                #endif
+            }
 
-    /* Convert this wavelength into nanometers. */
-    float w_nm = (wavelength * 400 + 380) * 1e-9f;
+            if (working)
+            {
+                /* Init PRNG for this sample of this pixel. */
+                prng = initPixel(pixel, coords, first + sample++, seed);
 
-    /* Find light path. */
-    float radiance = 0.0f;
-    while (true)
-    {
-        /* Object hit and far point. */
-        uint hit = (uint)-1; float t_d;
+                /* Trace a camera ray through the pixel. */
+                CameraRay(coords, &prng, params, camera, &origin, &direction);
 
-        #ifdef KERNEL_MODE_NOACCEL
-        /* Intersect the ray against the test sphere scene. */
-        if (!NoAccel_Intersect(origin, direction, &t_d, &hit))
-        #else
-        /* Intersect the ray against the entire scene using the tree. */
-        if (!Intersect(origin, direction, &t_d, &hit, triangles, nodes))
-        #endif
-        {
-            /* Escaped ray - implement sky system here later. */
-            radiance = 0.0f;
-            break;
+                #ifdef KERNEL_MODE_NOACCEL
+                /* Use the scene's atmosphere. */
+                matStack[0] = NOACCEL_ATMOSPHERE;
+                #else
+                /* Atmospheric medium. */
+                matStack[0] = mapping[0];
+                #endif
+                matPos = 0;
+
+                /* Select a random hero wavelength, and rotate it to obtain *
+                 * three more, evenly spread over the sampling distribution *
+                 * (which favors the wavelengths the eye is sensitive to).  */
+                float4 u = rand(&prng) + (float4)(0.0f, 0.25f, 0.5f, 0.75f);
+                wavelengths = SampleWavelengths(u - floor(u), spectrum, &w_pdf);
+
+                /* Convert these wavelengths into meters. */
+                w_m = (wavelengths * 400 + 380) * 1e-9f;
+
+                throughput = (float4)(1.0f);
+                radiance = (float4)(0.0f);
+                bsdfPdf = 0.0f;
+                depth = 0;
+                active = true;
+
+                #ifdef KERNEL_MODE_SPLIT
+                branch = branches = 0;
+                #endif
+            }
         }
 
-        #ifdef KERNEL_MODE_NOACCEL
-        /* Get the intersected sphere material. */
-        uint mappingMatID = spheres[hit].material;
-        #else
-        /* Get the intersected triangle. */
-        Triangle triangle = triangles[hit];
+        /* Remember whether a light path is being traced this iteration. */
+        bool tracing = active;
+
+        /* Surface interaction, if the ray hit a surface. */
+        Interaction interaction;
+        bool shading = false;
+
+        /* Weight of this iteration's scattering or reflection, if any. */
+        float4 weight = (float4)(1.0f);
+        float3 v_t, v_b, v_n;
 
-        /* Obtain the triangle's correct matID. */
-        uint mappingMatID = mapping[triangle.mat];
+        /* Object hit and far point. */
+        uint hit = (uint)-1; float t_d = INFINITY;
+
+        /* Whether the light path has a ray to trace this iteration. */
+        bool tracingRay = active;
+
+        #ifdef KERNEL_MODE_SPLIT
+        /* The next branch of a split light path starts by shading the *
+         * vertex it split at again, instead of tracing a ray.         */
+        if (resumed)
+        {
+            interaction = split;
+            origin = splitOrigin;
+            v_b = split_b; v_n = split_n; v_t = split_t;
+            shading = true;
+            tracingRay = resumed = false;
+        }
         #endif
 
-        /* Calculate medium absorption coefficient. */
-        float ke = absorption(matStack[matPos], w_nm);
+        #ifdef KERNEL_MODE_RAYSORT
+        /* Sort the rays, and trace the ray in this work-item's slot. */
+        uint rank = RadixSort(RayKey(tracingRay, origin, direction, nodes),
+                              RAY_KEY_BITS, sortKeys, sortBins);
+        rayOrigins[rank] = (float4)(origin, tracingRay ? 1.0f : 0.0f);
+        rayDirections[rank] = (float4)(direction, 0.0f);
+        barrier(CLK_LOCAL_MEM_FENCE);
 
-        /* Expected scattering distance. */
-        float s_d = -log(rand(&prng)) / ke;
+        if (rayOrigins[lid].w != 0.0f)
+        {
+            Intersect(rayOrigins[lid].xyz, rayDirections[lid].xyz,
+                      &t_d, &hit, triangles, nodes);
+            rayDistances[lid] = t_d;
+            rayHits[lid] = hit;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
 
-        /* Scatter? */
-        if (s_d < t_d)
+        if (tracingRay)
         {
-            /* Advance to scatter location. */
-            origin = origin + s_d * direction;
-
-            /* Build the phase basis (scattering is always isotropic). */
-            float3 v_t = normalize(cross(direction, direction + VDELTA));
-            float3 v_b = normalize(cross(direction, v_t));
-            float3 v_n = direction;
-
-            /* Compute the inverse phase basis here. */
-            float3 w_b = (float3)(v_b.x, v_n.x, v_t.x);
-            float3 w_n = (float3)(v_b.y, v_n.y, v_t.y);
-            float3 w_t = (float3)(v_b.z, v_n.z, v_t.z);
-
-            /* Rotate into unit space. */
-            direction = direction.x * w_b
-                      + direction.y * w_n
-                      + direction.z * w_t;
-
-
-            /* Scatter the ray by using this material's properties. */
-            float4 scattered = scatter(matStack[matPos], w_nm, &prng);
-            direction = scattered.xyz;
-            radiance  = scattered.w;
-
-            /* Go back to world space. */
-            direction = direction.x * v_b
-                      + direction.y * v_n
-                      + direction.z * v_t;
+            t_d = rayDistances[rank];
+            hit = rayHits[rank];
         }
-        else
+        #endif
+
+        if (tracingRay)
         {
-            /* Move ray to intersection pt. */
-            origin = origin + t_d * direction;
-
-            #ifdef KERNEL_MODE_NOACCEL
-            /* Get the sphere normal, at the intersection. */
-            float3 v_n = ComputeNormal(origin, spheres[hit]);
-            float3 v_t = normalize(cross(v_n, v_n + VDELTA));
-            float3 v_b = normalize(cross(v_n, v_t));
+            #if defined(KERNEL_MODE_RAYSORT)
+            /* The ray was traced by the work-item its slot fell to. */
+            bool escaped = (hit == (uint)-1);
+            #elif defined(KERNEL_MODE_NOACCEL)
+            /* Intersect the ray against the test sphere scene. */
+            bool escaped = !NoAccel_Intersect(origin, direction, &t_d, &hit);
             #else
-            /* Obtain TBN matrix. */
-            float3 v_t = triangle.t;
-            float3 v_b = triangle.b;
-            float3 v_n = triangle.n;
+            /* Intersect the ray against the entire scene using the tree. */
+            bool escaped = !Intersect(origin, direction, &t_d, &hit,
+                                      triangles, nodes);
             #endif
 
-            /* Flip the normal, with the bitangent, if necessary. */
-            if (dot(v_n, direction) > 0) { v_n = -v_n; v_b = -v_b; }
+            /* An escaped ray may still cross a density grid on its way out. */
+            if (escaped) t_d = INFINITY;
+
+            constant Material *medium = materials + matStack[matPos];
+            float s_d = INFINITY;
+
+            if (heterogeneous(medium))
+            {
+                /* Track the ray through the medium's density grid. */
+                s_d = DeltaTrack(medium, w_m, origin, direction, t_d,
+                                 &prng, volumes, grids, &throughput);
+            }
+            else if (!escaped)
+            {
+                /* Calculate medium absorption coefficients. */
+                float4 ke = absorption(medium, w_m);
+
+                /* Expected scattering distance, at the hero wavelength. */
+                s_d = -log(rand(&prng)) / ke.x;
+
+                /* Probability density (or probability, if the ray  *
+                 * reaches the surface) of this distance at each    *
+                 * wavelength, which is also its contribution, so   *
+                 * weight each wavelength by its share among all    *
+                 * four (as any could have been hero).              */
+                float4 p_d = (s_d < t_d) ? ke * exp(-ke * s_d)
+                                         : exp(-ke * t_d);
+                throughput *= p_d / dot(p_d, (float4)(0.25f));
+            }
+
+            /* Scatter? */
+            if (s_d < t_d)
+            {
+                /* Advance to scatter location. */
+                origin = origin + s_d * direction;
 
-            /* Construct an inverse TBN matrix here. */
-            float3 w_b = (float3)(v_b.x, v_n.x, v_t.x);
-            float3 w_n = (float3)(v_b.y, v_n.y, v_t.y);
-            float3 w_t = (float3)(v_b.z, v_n.z, v_t.z);
+                /* Build the phase basis (scattering is always isotropic). */
+                v_t = normalize(cross(direction, direction + VDELTA));
+                v_b = normalize(cross(direction, v_t));
+                v_n = direction;
 
-            /* Transform to TBN space. */
-            direction = direction.x * w_b
-                      + direction.y * w_n
-                      + direction.z * w_t;
+                /* Compute the inverse phase basis here. */
+                float3 w_b = (float3)(v_b.x, v_n.x, v_t.x);
+                float3 w_n = (float3)(v_b.y, v_n.y, v_t.y);
+                float3 w_t = (float3)(v_b.z, v_n.z, v_t.z);
 
-            /* Check if the triangle emits light, and if so, stop. */
-            radiance = exitant(mappingMatID, w_nm, direction, &prng);
-            if (radiance > 0.0f) break; /* This is a light source. */
+                /* Rotate into unit space. */
+                direction = direction.x * w_b
+                          + direction.y * w_n
+                          + direction.z * w_t;
 
-            /* Nested media? */
-            bool nested = true;
+                /* Scatter the ray by using this material's properties. */
+                direction = scatter(medium, w_m, &prng, &weight);
+                bsdfPdf = 0.0f;
 
-            /* Select the right media at the interface. */
-            uint in = matStack[matPos], to = mappingMatID;
-            if (mappingMatID == matStack[matPos])
+                /* Go back to world space. */
+                direction = direction.x * v_b
+                          + direction.y * v_n
+                          + direction.z * v_t;
+            }
+            else if (escaped)
             {
-                /* Leaving this medium. */
-                to = matStack[matPos - 1];
-                nested = false;
+                /* Escaped ray, it is lit by the sky. */
+                float4 Le = SkyRadiance(direction, w_m, skyMap, sky);
+
+                #ifdef KERNEL_MODE_NEE
+                /* Weight against sampling the sky explicitly. */
+                if (bsdfPdf > 0.0f)
+                    Le *= PowerHeuristic(bsdfPdf,
+                                         SkyDensity(direction, skyMap, sky));
+                #endif
+
+                radiance += throughput * Le;
+                active = false;
             }
+            else
+            {
+                #ifdef KERNEL_MODE_NOACCEL
+                /* Get the intersected sphere material. */
+                uint mappingMatID = spheres[hit].material;
+                #else
+                /* Get the intersected triangle. */
+                Triangle triangle = triangles[hit];
+
+                /* Obtain the triangle's correct matID. */
+                uint mappingMatID = mapping[triangle.mat];
+                #endif
+
+                /* Move ray to intersection pt. */
+                origin = origin + t_d * direction;
+
+                #ifdef KERNEL_MODE_NOACCEL
+                /* Get the sphere normal, at the intersection. */
+                v_n = ComputeNormal(origin, spheres[hit]);
+                v_t = normalize(cross(v_n, v_n + VDELTA));
+                v_b = normalize(cross(v_n, v_t));
+                #else
+                /* Obtain TBN matrix. */
+                v_t = triangle.t;
+                v_b = triangle.b;
+                v_n = triangle.n;
+                #endif
+
+                /* Flip the normal, with the bitangent, if necessary. */
+                if (dot(v_n, direction) > 0) { v_n = -v_n; v_b = -v_b; }
 
-            /* Reflect this ray, using this material's reflectance function. */
-            float4 reflected = reflect(in, to, w_nm, direction, &prng, nested);
-            direction = reflected.xyz;
-            radiance  = reflected.w;
+                /* Construct an inverse TBN matrix here. */
+                float3 w_b = (float3)(v_b.x, v_n.x, v_t.x);
+                float3 w_n = (float3)(v_b.y, v_n.y, v_t.y);
+                float3 w_t = (float3)(v_b.z, v_n.z, v_t.z);
 
-            /* Go back to world space. */
-            direction = direction.x * v_b
-                      + direction.y * v_n
-                      + direction.z * v_t;
+                /* Transform to TBN space. */
+                direction = direction.x * w_b
+                          + direction.y * w_n
+                          + direction.z * w_t;
+
+                /* Nested media? */
+                bool nested = true;
+
+                /* Select the right media at the interface. */
+                uint in = matStack[matPos], to = mappingMatID;
+                if (mappingMatID == matStack[matPos])
+                {
+                    /* Leaving this medium. */
+                    to = matStack[matPos - 1];
+                    nested = false;
+                }
+
+                interaction.incident    = (float4)(direction, 0.0f);
+                interaction.wavelengths = w_m;
+                interaction.matID       = mappingMatID;
+                interaction.in          = in;
+                interaction.to          = to;
+                interaction.nested      = nested;
+                shading = true;
+            }
+        }
+
+        #ifdef KERNEL_MODE_SORTED
+        /* Sort the interactions by model, idle work-items go last. */
+        uint key = shading ? min(materials[interaction.matID].model,
+                                 (uint)SORT_BINS - 2) : SORT_BINS - 1;
+        uint slot = CountingSort(key, sortKeys, sortBins);
+        if (shading)
+        {
+            interactions[slot] = interaction;
+            shadedPRNGs[slot] = prng;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        /* Shade the interaction in this work-item's slot, if any, with the *
+         * sampler of the light path it belongs to, which keeps each path's *
+         * dimensions in order (as the Sobol sampler requires).             */
+        if (lid < sortBins[SORT_BINS - 1])
+        {
+            float4 w; float p;
+            PRNG sampler = shadedPRNGs[lid];
+            float3 r = shade(interactions[lid], materials, &sampler, &w, &p);
+            shaded[lid] = (float4)(r, p);
+            shadedWeights[lid] = w;
+            shadedPRNGs[lid] = sampler;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        float3 result = shaded[slot].xyz;
+        float pdf = shaded[slot].w;
+        if (shading)
+        {
+            weight = shadedWeights[slot];
+            prng = shadedPRNGs[slot];
+        }
+        #else
+        float3 result = (float3)(0.0f);
+        float pdf = 0.0f;
+        if (shading)
+            result = shade(interaction, materials, &prng, &weight, &pdf);
+        #endif
+
+        if (shading)
+        {
+            /* Check if the surface emits light, and if so, stop. */
+            if (all(result == (float3)(0.0f)))
+            {
+                #ifdef KERNEL_MODE_NEE
+                /* Weight against sampling this light source explicitly. */
+                if (bsdfPdf > 0.0f)
+                {
+                    float cosL = fabs(interaction.incident.y);
+                    float areaPdf = LightAreaDensity(hit, lastVertex,
+                                                     triangles, lightTree,
+                                                     lightArea);
+                    weight *= PowerHeuristic(bsdfPdf,
+                                    LightDensity(t_d, cosL, areaPdf));
+                }
+                #endif
 
-            /* Is ray reflected? */
-            if (reflected.y < 0.0f)
+                radiance += throughput * weight;
+                active = false;
+            }
+            else
             {
-                /* Ray is transmitted. */
-                origin += (-v_n) * PSHBK;
+                #ifdef KERNEL_MODE_SPLIT
+                /* Split the light path at its first diffuse vertex, and *
+                 * remember the vertex, to come back to for each branch. */
+                if ((branches == 0) && diffuse(materials + interaction.in,
+                                               materials + interaction.to,
+                                               interaction.nested))
+                {
+                    branch = 1;
+                    branches = splitFactor;
+                    throughput /= branches;
+
+                    split = interaction;
+                    splitOrigin = origin;
+                    split_b = v_b; split_n = v_n; split_t = v_t;
+                    splitThroughput = throughput;
+                    for (uint t = 0; t <= matPos; ++t)
+                        splitStack[t] = matStack[t];
+                    splitPos = matPos;
+                    splitDepth = depth;
+                }
+                #endif
+
+                #ifdef KERNEL_MODE_NEE
+                /* Sample the light sources from diffuse surfaces. */
+                bool sampled = diffuse(materials + interaction.in,
+                                       materials + interaction.to,
+                                       interaction.nested);
+                bsdfPdf = sampled ? pdf : 0.0f;
+                lastVertex = origin + v_n * PSHBK;
+
+                if (sampled)
+                    radiance += throughput * DirectLight(interaction,
+                                    lastVertex, v_b, v_n, v_t, &prng,
+                                    triangles, nodes, lights, lightTree,
+                                    lightCount, lightArea, mapping, materials,
+                                    volumes, grids);
+
+                if (sampled)
+                    radiance += throughput * DirectSky(interaction,
+                                    lastVertex, v_b, v_n, v_t, &prng,
+                                    triangles, nodes, skyMap, skyCdf, sky,
+                                    materials, volumes, grids);
+                #endif
+
+                /* Go back to world space. */
+                direction = result.x * v_b
+                          + result.y * v_n
+                          + result.z * v_t;
 
-                /* Has this light ray left current material? */
-                if (mappingMatID == matStack[matPos]) matPos--;
+                /* Is ray reflected? */
+                if (result.y < 0.0f)
+                {
+                    /* Ray is transmitted. */
+                    origin += (-v_n) * PSHBK;
+
+                    /* Has this light ray left current material? */
+                    if (interaction.matID == matStack[matPos]) matPos--;
+                    else
+                    {
+                        /* Else, add material to stack. */
+                        matStack[++matPos] = interaction.matID;
+                    }
+                }
                 else
                 {
-                    /* Else, add material to stack. */
-                    matStack[++matPos] = mappingMatID;
+                    /* Push this ray back. */
+                    origin += (+v_n) * PSHBK;
                 }
             }
+        }
+
+        /* Carry the weights over to the throughput, then play Russian  *
+         * roulette with it, each branch of a split light path being    *
+         * compared against its share of the throughput at the split.   */
+        if (active)
+        {
+            float start = 1.0f;
+            #ifdef KERNEL_MODE_SPLIT
+            if (branches) start /= branches;
+            #endif
+
+            throughput *= weight;
+            if (!Roulette(&prng, &throughput, start, depth++)) active = false;
+        }
+
+        #ifdef KERNEL_MODE_SPLIT
+        if (tracing && !active && branches)
+        {
+            /* Account for the branch's length, then trace the next one. */
+            splitStats.w += (float)(depth - splitDepth) / branches;
+
+            if (branch < branches)
+            {
+                ++branch;
+                throughput = splitThroughput;
+                for (uint t = 0; t <= splitPos; ++t)
+                    matStack[t] = splitStack[t];
+                matPos = splitPos;
+                depth = splitDepth;
+                active = resumed = true;
+            }
             else
             {
-                /* Push this ray back. */
-                origin += (+v_n) * PSHBK;
+                splitStats.y += 1.0f;
+                splitStats.z += splitDepth + 1;
             }
         }
+        #endif
 
-        /* Perform adaptive russian roulette here (discard). */
-        if (rand(&prng) > radiance) { radiance = 0.0f; break; }
-    }
+        if (tracing && !active)
+        {
+            /* Transform these spectral samples to a color using the curve, *
+             * weighted by the inverse of their sampling densities.          */
+            float3 xyz = SpectralColor(wavelengths, radiance / w_pdf,
+                                       spectrum);
 
-    /* Transform this spectral sample to a color using the spectral curve. */
-    float3 xyz = read_imagef(spectrum, sampler, (float2)(wavelength, 0)).xyz;
+            /* Accumulate this spectral sample, and when the pixel is done, *
+             * accumulate all of its samples into the pixel buffer at once. */
+            accumulated += (float4)(xyz * 0.25f, 1);
+            #ifdef KERNEL_MODE_ADAPTIVE
+            moment += (xyz.y * 0.25f) * (xyz.y * 0.25f);
+            #endif
+            #ifdef KERNEL_MODE_SPLIT
+            splitStats.x += (xyz.y * 0.25f) * (xyz.y * 0.25f);
+            #endif
 
-    /* Accumulate this spectral sample into pixel buffer. */
-    buffer[get_global_id(0)] += (float4)(xyz * radiance, 1);
+            if (sample == count)
+            {
+                AccumulatePixel(buffer, pixel, accumulated);
+                accumulated = (float4)(0.0f);
+                #ifdef KERNEL_MODE_ADAPTIVE
+                moments[pixel] += moment;
+                moment = 0.0f;
+                #endif
+                #ifdef KERNEL_MODE_SPLIT
+                splitting[pixel] += splitStats;
+                splitStats = (float4)(0.0f);
+                #endif
+            }
+        }
+    }
 }
+
+#ifdef KERNEL_MODE_BDPT
+#include <bdpt.cl>
+#endif
+
+#ifdef KERNEL_MODE_SPPM
+#include <sppm.cl>
+#endif
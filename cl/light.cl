@@ -0,0 +1,198 @@
+#pragma once
+
+#include <triangle.cl>
+#include <prng.cl>
+
+/** @file light.cl
+  * @brief Light source sampling.
+  *
+  * The renderer gathers the scene's emissive triangles into a light list, with
+  * the cumulative distribution of their areas, so that points can be sampled
+  * uniformly over the total area of the light sources. It also builds a light
+  * tree over them, through which they can be sampled by their estimated
+  * contribution to a given point instead, see \c LightTree.
+**/
+
+/** @struct Light
+  * @brief Light list entry.
+**/
+typedef struct Light
+{
+    /** The emissive triangle's index. **/
+    uint triangle;
+    /** The fraction of the total area of the light sources which is covered
+      * by the triangles of this entry and of all the ones before it.
+    **/
+    float cdf;
+} Light;
+
+/** @struct LightNode
+  * @brief Light tree node.
+**/
+typedef struct LightNode
+{
+    /** The node's bounding box minimum, and the total power of its emitters
+      * in the w-component.
+    **/
+    float4 min;
+    /** The node's bounding box maximum, and the angle of the cone bounding its
+      * emitters' normals (in either direction) in the w-component.
+    **/
+    float4 max;
+    /** The axis of the cone bounding its emitters' normals. **/
+    float4 axis;
+    /** The index of the node's right child (its left child follows it), or
+      * zero if it is a leaf, and the leaf's emissive triangle.
+    **/
+    uint4 data;
+} LightNode;
+
+/** Samples a point uniformly over an emissive triangle.
+  * @param prng A PRNG instance.
+  * @param triangle The triangle.
+  * @returns The sampled point.
+**/
+float3 SampleTriangle(PRNG *prng, global Triangle *triangle)
+{
+    float r = sqrt(rand(prng)), v = rand(prng);
+    return triangle->p1 + r * (1 - v) * triangle->e1 + r * v * triangle->e2;
+}
+
+/** Samples a point uniformly over the total area of the light sources, so the
+  * density of the point is the inverse of that area.
+  * @param prng A PRNG instance.
+  * @param lights The light list.
+  * @param count The number of entries in the light list, nonzero.
+  * @param triangles The list of triangles in the scene.
+  * @param point A pointer in which to store the sampled point.
+  * @returns The index of the emissive triangle the point lies on.
+**/
+uint SampleLight(PRNG *prng, global Light *lights, uint count,
+                 global Triangle *triangles, float3 *point)
+{
+    float u = rand(prng);
+
+    /* Select a triangle by area, by binary search. */
+    uint lo = 0, hi = count - 1;
+    while (lo < hi)
+    {
+        uint mid = (lo + hi) / 2;
+        if (lights[mid].cdf <= u) lo = mid + 1;
+        else hi = mid;
+    }
+
+    /* Then a point on it, uniformly. */
+    uint index = lights[lo].triangle;
+    *point = SampleTriangle(prng, triangles + index);
+    return index;
+}
+
+/** Returns the area of an emissive triangle.
+  * @param triangle The triangle.
+  * @returns The triangle's area.
+**/
+float TriangleArea(global Triangle *triangle)
+{
+    return 0.5f * length(cross(triangle->e1, triangle->e2));
+}
+
+/** Estimates how much light the emitters of a light tree node contribute to a
+  * point, from the node's bounds only. This is conservative, in that it is only
+  * zero if none of them can light the point.
+  * @param node The light tree node.
+  * @param p The point.
+  * @returns The node's importance to the point.
+**/
+float LightImportance(global LightNode *node, float3 p)
+{
+    float3 center = 0.5f * (node->min.xyz + node->max.xyz);
+    float3 d = center - p;
+    float d2 = dot(d, d);
+    float r2 = 0.25f * dot(node->max.xyz - node->min.xyz,
+                           node->max.xyz - node->min.xyz);
+
+    /* Angle between the cone's axis and the point, which can't be less than *
+     * the cone's angle plus that of the bounding sphere, seen from the point. */
+    float cosTheta = (d2 > 0.0f) ? fabs(dot(node->axis.xyz, d)) / sqrt(d2)
+                                 : 1.0f;
+    float thetaU = (d2 > r2) ? asin(sqrt(r2 / d2)) : PI;
+    float theta = acos(fmin(cosTheta, 1.0f)) - node->max.w - thetaU;
+
+    if (theta >= 0.5f * PI) return 0.0f;
+    return node->min.w * cos(fmax(theta, 0.0f)) / fmax(d2, r2);
+}
+
+/** Samples an emissive triangle from the light tree, by descending it from the
+  * root towards either child in proportion to their importance to a point.
+  * @param prng A PRNG instance.
+  * @param tree The light tree, nonempty.
+  * @param p The point to be lit.
+  * @param probability A pointer in which to store the probability of the
+  *                    triangle, which is zero if no triangle can light \c p.
+  * @returns The triangle's index.
+**/
+uint SampleLightTree(PRNG *prng, global LightNode *tree, float3 p,
+                     float *probability)
+{
+    float u = rand(prng);
+    uint index = 0;
+    *probability = 1.0f;
+
+    while (tree[index].data.x != 0)
+    {
+        float l = LightImportance(tree + index + 1, p);
+        float r = LightImportance(tree + tree[index].data.x, p);
+        if (l + r == 0.0f) { *probability = 0.0f; return 0; }
+
+        /* Reuse the random number, rescaled, for the next level. */
+        float left = l / (l + r);
+        if (u < left)
+        {
+            u = u / left;
+            *probability *= left;
+            index = index + 1;
+        }
+        else
+        {
+            u = (u - left) / (1.0f - left);
+            *probability *= 1.0f - left;
+            index = tree[index].data.x;
+        }
+
+        u = fmin(u, 0x1.fffffep-1f);
+    }
+
+    return tree[index].data.y;
+}
+
+/** Returns the probability with which \c SampleLightTree samples a triangle.
+  * @param trail The triangle's trail in the light tree, see \c Triangle.
+  * @param tree The light tree, nonempty.
+  * @param p The point to be lit.
+  * @returns The probability of the triangle.
+**/
+float LightTreeProbability(uint trail, global LightNode *tree, float3 p)
+{
+    float probability = 1.0f;
+    uint index = 0;
+
+    for (uint depth = 0; tree[index].data.x != 0; ++depth)
+    {
+        float l = LightImportance(tree + index + 1, p);
+        float r = LightImportance(tree + tree[index].data.x, p);
+        if (l + r == 0.0f) return 0.0f;
+
+        if ((trail >> depth) & 1)
+        {
+            probability *= r / (l + r);
+            index = tree[index].data.x;
+        }
+        else
+        {
+            probability *= l / (l + r);
+            index = index + 1;
+        }
+    }
+
+    return probability;
+}
@@ -10,14 +10,51 @@
 /** @file material.cl
   * @brief Material dispatching.
   *
-  * This file is responsible for dispatching material ID's to the appropriate
-  * handling code. Each material ID has its own OpenCL file, this is just one
-  * giant switch statement. You are meant to add your own materials, so, feel
-  * free to edit this file.
+  * This file is responsible for dispatching materials to the appropriate model
+  * handling code. The materials themselves are data: a table of \c Material's
+  * loaded from the scene's materials.xml and uploaded by the renderer, so they
+  * can be added or tweaked without touching the kernel. Each model has its own
+  * OpenCL file, this just switches over the small set of models. You are meant
+  * to add your own models, so, feel free to edit this file (and the renderer's
+  * material loader, which maps model names to the values below).
   *
-  * \todo Finalize the material system's interface.
+  * Every light path carries four wavelengths at once (see epsilon.cl), so all
+  * functions below take and return one value per wavelength, as a \c float4.
+  * The first component is the hero wavelength, which decides the direction of
+  * the light path if the wavelengths would otherwise go separate ways.
 **/
 
+/** @brief No surface interaction, absorbs all light (e.g. pure media). **/
+#define MODEL_NONE 0x00000000
+
+/** @brief Black-body light source, params = (temperature). **/
+#define MODEL_LIGHT 0x00000001
+
+/** @brief Diffuse, flat spectral response, params = (albedo). **/
+#define MODEL_MATTE 0x00000002
+
+/** @brief Diffuse, peaked spectral response, params = (peak, dev, albedo). **/
+#define MODEL_MATTE_PEAK 0x00000003
+
+/** @brief Smooth dielectric interface, params = (loss). **/
+#define MODEL_GLASS 0x00000004
+
+/** The set of models used by the scene's materials, as a bitmask. When the
+  * kernel is specialized, the renderer sets this and the cases of the switches
+  * below for models the scene doesn't use are compiled out.
+**/
+#ifndef SCENE_MODELS
+#define SCENE_MODELS 0xFFFFFFFF
+#endif
+
+/** Whether a given model is used by the scene, see \c SCENE_MODELS. This can
+  * be used in preprocessor conditionals.
+**/
+#define USES(model) ((SCENE_MODELS >> model) & 1)
+
+/* These are the built-in materials, which are always at the start of the *
+ * material table (and may be referred to by MatID in materials.xml).     */
+
 /** @brief Vacuum, used as an atmosphere for non-volumetric renders. **/
 #define VACUUM 0x00000000
 
@@ -42,132 +79,292 @@
 /** @brief Absorbing red glass material (weaker). **/
 #define GLASS_RED_WEAK 0x00000007
 
+/** @struct Material
+  * @brief Material parameters.
+  *
+  * This is an entry of the material table, which describes both the surface
+  * of an object (through its model) and the medium inside of it.
+**/
+typedef struct Material
+{
+    /** The model's parameters, see the \c MODEL_* definitions. **/
+    float4 params;
+    /** The medium's refractive index, or negative if it is not a medium. **/
+    float index;
+    /** The medium's absorption strength, or zero for (almost) none. **/
+    float absorption;
+    /** The material's model, one of the \c MODEL_* definitions. **/
+    uint model;
+    /** The medium's density grid, see volume.cl, or zero if it has none. **/
+    uint volume;
+    /** The wavelength (nm) the medium lets through, or zero if it is grey. **/
+    float tint;
+} Material;
+
 /** This function returns the material's exitant spectral radiance, this is the
   * lighting term, if the material is not a light source this must be negative,
   * or zero, otherwise the material will be considered as emissive.
-  * @param matID The material ID.
-  * @param wavelength The light's wavelength.
+  * @param material The material.
+  * @param wavelength The light's wavelengths.
   * @param incident The incident ray, in TBN space.
   * @param prng A PRNG instance.
-  * @returns The exitant spectral radiance.
-  * @note If this returns a positive result, then the material ID will never be
-  *       used in any other function (\c absorption, \c scatter, \c reflect).
+  * @returns The exitant spectral radiance, at each wavelength.
+  * @note If this returns a positive result (at the hero wavelength), then the
+  *       material will never be used in any other function (\c absorption,
+  *       \c scatter, \c reflect).
 **/
-float exitant(uint matID, float wavelength, float3 incident, PRNG *prng)
+float4 exitant(constant Material *material, float4 wavelength,
+               float3 incident, PRNG *prng)
 {
-    /* Because the default behavior is to return negative 1, if the material *
-     * is not emissive (not a light source) you are free to ignore this.     */
-    switch (matID)
+    switch (material->model)
     {
-        case WHITE_FLUORESCENT: return blackbody(wavelength, 3500.0f);
+        #if USES(MODEL_LIGHT)
+        case MODEL_LIGHT: return blackbody(wavelength, material->params.x);
+        #endif
 
-        default: return -1.0f;
+        default: return (float4)(-1.0f);
     }
 }
 
 /** This function returns the material's absorption coefficient.
-  * @param matID The material ID.
-  * @param wavelength The light's wavelength.
-  * @return The absorption coefficient.
+  * @param material The material.
+  * @param wavelength The light's wavelengths.
+  * @return The absorption coefficient, at each wavelength.
+  * @note If the medium has a density grid, this is the coefficient at unit
+  *       density, which the grid scales at every point (see volume.cl).
 **/
-float absorption(uint matID, float wavelength)
+float4 absorption(constant Material *material, float4 wavelength)
 {
-    /* The default behavior of this function is to return a value very close *
-     * to zero, corresponding to no absorption. If the material doesn't have *
-     * absorption properties, you are free to not implement this function.   */ 
-    switch (matID)
-    {
-        case GLASS_RED: return glass_abs(wavelength, 1.2f);
-        case GLASS_RED_WEAK: return glass_abs(wavelength, 0.08f);
-
-        default: return 1e-6f;
-    }
+    /* Media without absorption get a value very close to zero instead. */
+    if (material->absorption <= 0.0f) return (float4)(1e-6f);
+    return glass_abs(wavelength, material->absorption, material->tint);
 }
 
 /** This function returns the material's refractive index.
-  * @param matID The material ID.
-  * @param wavelength The light's wavelength.
-  * @returns The material's refractive index at the given wavelength.
+  * @param material The material.
+  * @param wavelength The light's wavelengths.
+  * @returns The material's refractive index at each wavelength, which is
+  *          negative if the material is not a medium.
 **/
-float index(uint matID, float wavelength)
+float4 index(constant Material *material, float4 wavelength)
 {
-    /* The default behavior of this function is to explicitly return zero to *
-     * prevent forgetting to implement it, as it is required: any medium has *
-     * a refractive index, and there is no reasonable "default value".       */
-    switch (matID)
-    {
-        case VACUUM: return 1.0f;
-        case GLASS_RED: return 1.55f;
-        case GLASS_RED_WEAK: return 1.55f;
-
-        default: return -1.0f;
-    }
+    return (float4)(material->index);
 }
 
 /** This function evaluates the material's phase function and returns an
   * importance-sampled scattered ray.
-  * @param matID The material ID.
-  * @param w The light's wavelength.
+  * @param material The material.
+  * @param w The light's wavelengths.
   * @param prng A PRNG instance.
+  * @param weight A pointer in which to store the normalization term at each
+  *               wavelength, in case the phase function does not integrate to
+  *               1, which should be multiplied with the path's throughput.
   * @returns An importance-sampled scattered ray, in unit space. Rotate
   *          according to the incident ray to obtain the scattered ray
   *          in world space.
-  * @note The w-component of the resulting ray contains the normalization term
-  *       in case the phase function does not integrate to 1 - which should be
-  *       multiplied with the radiance.
 **/
-float4 scatter(uint matID, float w, PRNG *prng)
+float3 scatter(constant Material *material, float4 w, PRNG *prng,
+               float4 *weight)
 {
     /* For materials which are purely absorbing, we assume scattering causes *
-     * the ray intensity to decay to nil. Thus if your material doesn't have *
-     * this property, you don't need to implement the scatter function.      */
-    switch (matID)
+     * the ray intensity to decay to nil. No model scatters light for now.   */
+    switch (material->model)
     {
-        default: return (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+        default: *weight = (float4)(0.0f); return (float3)(0.0f);
     }
 }
 
 /** This function evaluates the material's reflectance function and returns an
   * importance-sampled reflected or transmitted ray.
-  * @param in The material ID of the medium the ray is in.
-  * @param to The material ID of the medium beyond the interface.
-  * @param w The light's wavelength.
+  * @param in The material of the medium the ray is in.
+  * @param to The material of the medium beyond the interface.
+  * @param w The light's wavelengths.
   * @param incident The incident ray, in TBN space.
   * @param prng a PRNG instance.
   * @param nested Whether the \c to medium is nested inside the \c in medium.
+  * @param weight A pointer in which to store the normalization term at each
+  *               wavelength, in case the reflectance function does not
+  *               integrate to 1, which should be multiplied with the path's
+  *               throughput. Wavelengths which cannot follow the returned ray
+  *               (e.g. on dispersion) get a zero weight.
+  * @param pdf A pointer in which to store the density (per solid angle) with
+  *            which the ray was sampled, as returned by \c density, or zero
+  *            if the surface is not \c diffuse.
   * @returns An importance-sampled reflected or transmitted ray, in TBN space.
   *          Rotate via the TBN basis to obtain the ray in world space.
   * @note To verify if the ray was transmitted or not, it is enough to check
   *       the sign of \c result.y. If negative, the ray was transmitted.
-  * @note The w-component of the resulting ray contains the normalization term
-  *       in case the reflectance function does not integrate to 1, this value 
-  *       should be multiplied with the radiance.
-
 **/
-float4 reflect(uint in, uint to, float w, float3 incident, PRNG *prng,
-               bool nested)
+float3 reflect(constant Material *in, constant Material *to, float4 w,
+               float3 incident, PRNG *prng, bool nested, float4 *weight,
+               float *pdf)
 {
-    switch (nested? to : in)
+    constant Material *surface = nested ? to : in;
+    float4 p = surface->params;
+    float3 reflected;
+    *pdf = 0.0f;
+
+    switch (surface->model)
     {
-        case DIFFUSE_WHITE: return matte_flat(w, prng, 0.8f);
-        case DIFFUSE_RED: return matte_peak(w, prng, 640, 0.001f, 0.55f);
-        case DIFFUSE_BLUE: return matte_peak(w, prng, 460, 0.001f, 0.55f);
-        case DIFFUSE_GREEN: return matte_peak(w, prng, 525, 0.01f, 0.55f);
-        case GLASS_RED:
+        #if USES(MODEL_MATTE)
+        case MODEL_MATTE:
+            reflected = matte_flat(w, prng, p.x, weight);
+            *pdf = matte_pdf(reflected);
+            return reflected;
+        #endif
+        #if USES(MODEL_MATTE_PEAK)
+        case MODEL_MATTE_PEAK:
+            reflected = matte_peak(w, prng, p.x, p.y, p.z, weight);
+            *pdf = matte_pdf(reflected);
+            return reflected;
+        #endif
+        #if USES(MODEL_GLASS)
+        case MODEL_GLASS:
         {
-            float n1 = index(in, w);
-            float n2 = index(to, w);
+            float4 n1 = index(in, w);
+            float4 n2 = index(to, w);
 
-            return glass(prng, incident, n1, n2, 0.9f);
+            return glass(prng, incident, n1, n2, p.x, weight);
         }
-        case GLASS_RED_WEAK:
-        {
-            float n1 = index(in, w);
-            float n2 = index(to, w);
+        #endif
 
-            return glass(prng, incident, n1, n2, 0.9f);
-        }
+        default: *weight = (float4)(0.0f); return (float3)(0.0f);
+    }
+}
+
+/** This function returns whether the material's reflectance function can be
+  * evaluated for any pair of directions, via \c evaluate, which means light
+  * sources can be sampled explicitly from the surface (unlike e.g. glass, of
+  * which the reflectance function is a Dirac delta).
+  * @param in The material of the medium the ray is in.
+  * @param to The material of the medium beyond the interface.
+  * @param nested Whether the \c to medium is nested inside the \c in medium.
+  * @returns Whether the surface is diffuse.
+**/
+bool diffuse(constant Material *in, constant Material *to, bool nested)
+{
+    constant Material *surface = nested ? to : in;
+
+    switch (surface->model)
+    {
+        #if USES(MODEL_MATTE)
+        case MODEL_MATTE: return true;
+        #endif
+        #if USES(MODEL_MATTE_PEAK)
+        case MODEL_MATTE_PEAK: return true;
+        #endif
 
-        default: return (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+        default: return false;
     }
 }
+
+/** This function evaluates the material's reflectance function for a given
+  * reflected ray, which need not have been sampled by \c reflect.
+  * @param in The material of the medium the ray is in.
+  * @param to The material of the medium beyond the interface.
+  * @param w The light's wavelengths.
+  * @param incident The incident ray, in TBN space.
+  * @param reflected The reflected ray, in TBN space.
+  * @param nested Whether the \c to medium is nested inside the \c in medium.
+  * @returns The reflectance function at each wavelength, times the cosine of
+  *          the reflected ray with the normal, which is zero if the surface
+  *          is not \c diffuse.
+**/
+float4 evaluate(constant Material *in, constant Material *to, float4 w,
+                float3 incident, float3 reflected, bool nested)
+{
+    constant Material *surface = nested ? to : in;
+    float4 p = surface->params;
+
+    switch (surface->model)
+    {
+        #if USES(MODEL_MATTE)
+        case MODEL_MATTE: return matte_flat_eval(w, reflected, p.x);
+        #endif
+        #if USES(MODEL_MATTE_PEAK)
+        case MODEL_MATTE_PEAK:
+            return matte_peak_eval(w, reflected, p.x, p.y, p.z);
+        #endif
+
+        default: return (float4)(0.0f);
+    }
+}
+
+/** This function returns the density (per solid angle) with which \c reflect
+  * samples a given reflected ray.
+  * @param in The material of the medium the ray is in.
+  * @param to The material of the medium beyond the interface.
+  * @param w The light's wavelengths.
+  * @param incident The incident ray, in TBN space.
+  * @param reflected The reflected ray, in TBN space.
+  * @param nested Whether the \c to medium is nested inside the \c in medium.
+  * @returns The density of the reflected ray, which is zero if the surface is
+  *          not \c diffuse.
+**/
+float density(constant Material *in, constant Material *to, float4 w,
+              float3 incident, float3 reflected, bool nested)
+{
+    constant Material *surface = nested ? to : in;
+
+    switch (surface->model)
+    {
+        #if USES(MODEL_MATTE)
+        case MODEL_MATTE: return matte_pdf(reflected);
+        #endif
+        #if USES(MODEL_MATTE_PEAK)
+        case MODEL_MATTE_PEAK: return matte_pdf(reflected);
+        #endif
+
+        default: return 0.0f;
+    }
+}
+
+/** @struct Interaction
+  * @brief Surface interaction.
+  *
+  * This contains everything needed to shade a ray hitting a surface, so that
+  * the interaction can be handed over to another work-item for shading.
+**/
+typedef struct Interaction
+{
+    /** The incident ray in TBN space (the w-component is unused). **/
+    float4 incident;
+    /** The light path's wavelengths, in meters. **/
+    float4 wavelengths;
+    /** The material ID (table index) of the surface which was hit. **/
+    uint matID;
+    /** The material ID of the medium the ray is in. **/
+    uint in;
+    /** The material ID of the medium beyond the interface. **/
+    uint to;
+    /** Whether the \c to medium is nested inside the \c in medium. **/
+    uint nested;
+} Interaction;
+
+/** This function shades a surface interaction, by checking whether the surface
+  * is emissive via \c exitant, and reflecting the ray via \c reflect if not.
+  * @param interaction The surface interaction.
+  * @param materials The material table.
+  * @param prng A PRNG instance.
+  * @param weight A pointer in which to store the weight at each wavelength,
+  *               as returned by \c reflect, or, if the surface is emissive,
+  *               the exitant radiance.
+  * @param pdf A pointer in which to store the density of the ray, as returned
+  *            by \c reflect (zero if the surface is emissive).
+  * @returns The reflected or transmitted ray as returned by \c reflect, or, if
+  *          the surface is emissive, a zero vector, in which case the light
+  *          path ends.
+**/
+float3 shade(Interaction interaction, constant Material *materials,
+             PRNG *prng, float4 *weight, float *pdf)
+{
+    float4 w = interaction.wavelengths;
+    float3 incident = interaction.incident.xyz;
+
+    *pdf = 0.0f;
+    *weight = exitant(materials + interaction.matID, w, incident, prng);
+    if (weight->x > 0.0f) return (float3)(0.0f);
+
+    return reflect(materials + interaction.in, materials + interaction.to, w,
+                   incident, prng, interaction.nested, weight, pdf);
+}
@@ -1,6 +1,7 @@
 /* Black-body emission spectrum, any temperature. */
-float blackbody(float wavelength, float temperature)
+float4 blackbody(float4 wavelength, float temperature)
 {
-    float powerTerm = 3.74183e-16f * pow(wavelength, -5.0f);
+    float4 w5 = wavelength * wavelength * wavelength * wavelength * wavelength;
+    float4 powerTerm = 3.74183e-16f / w5;
     return powerTerm / (exp(1.4388e-2f / (wavelength * temperature)) - 1.0f);
 }
@@ -1,17 +1,26 @@
 #include <util.cl>
 
-float glass_abs(float wavelength, float strength)
+/* Absorbs all wavelengths but those around the tint (in nanometers), or all *
+ * of them evenly if the tint is zero.                                       */
+float4 glass_abs(float4 wavelength, float strength, float tint)
 {
-    float w = wavelength * 1e9f;
-    return 1e-5f + strength * (1 - exp(-pow(w - 650, 2) * 0.001f));
+    if (tint <= 0.0f) return (float4)(1e-5f + strength);
+
+    float4 w = wavelength * 1e9f - tint;
+    return 1e-5f + strength * (1 - exp(-w * w * 0.001f));
 }
 
-/* Smooth glass material. */
-float4 glass(PRNG* prng, float3 incident, float n1, float n2, float loss)
+/* Smooth glass material, the direction is chosen for the hero wavelength (x *
+ * component), if the refractive indices vary with wavelength and the ray is *
+ * transmitted, the other wavelengths are dropped (they'd go elsewhere).    */
+float3 glass(PRNG* prng, float3 incident, float4 n1, float4 n2, float loss,
+             float4 *weight)
 {
     float3 direction;
     float cosI = fabs(dot(incident, (float3)(0, 1, 0)));
-    float cosT = 1.0f - pow(n1 / n2, 2) * (1.0f - pow(cosI, 2));
+    float cosT = 1.0f - pow(n1.x / n2.x, 2) * (1.0f - pow(cosI, 2));
+
+    *weight = (float4)(loss);
 
     if (cosT < 0)
     {
@@ -21,7 +30,7 @@ float4 glass(PRNG* prng, float3 incident, float n1, float n2, float loss)
     {
         cosT = sqrt(cosT);
 
-        float R = Fresnel(n1, n2, incident, (float3)(0, 1, 0));
+        float R = Fresnel(n1.x, n2.x, incident, (float3)(0, 1, 0));
 
         if (rand(prng) < R)
         {
@@ -29,10 +38,14 @@ float4 glass(PRNG* prng, float3 incident, float n1, float n2, float loss)
         }
         else
         {
-            direction = incident * (n1 / n2)
-                      + (float3)(0, 1, 0) * ((n1 / n2) * cosI - cosT);
+            direction = incident * (n1.x / n2.x)
+                      + (float3)(0, 1, 0) * ((n1.x / n2.x) * cosI - cosT);
+
+            /* Dispersion, only the hero wavelength goes this way. */
+            if (any(n1 / n2 != (float4)(n1.x / n2.x)))
+                *weight = (float4)(4 * loss, 0, 0, 0);
         }
     }
 
-    return (float4)(direction, loss);
+    return direction;
 }
@@ -1,25 +1,47 @@
 /* Diffuse reflection, flat spectrum response. */
-float4 matte_flat(float w, PRNG *prng, float albedo)
+float3 matte_flat(float4 w, PRNG *prng, float albedo, float4 *weight)
 {
     float u = rand(prng), v = rand(prng);
     float a = 2 * 3.14169265f * v;
     float r = sqrt(u);
 
-    float3 reflected = (float3)(r * cos(a), sqrt(1.0f - u), r * sin(a));
-    return (float4)(reflected, albedo);   
+    *weight = (float4)(albedo);
+    return (float3)(r * cos(a), sqrt(1.0f - u), r * sin(a));
 }
 
 /* Diffuse reflection, peak spectrum response <peak, deviation>. */
-float4 matte_peak(float w, PRNG *prng, float peak, float dev, float albedo)
+float3 matte_peak(float4 w, PRNG *prng, float peak, float dev, float albedo,
+                  float4 *weight)
 {
     float u = rand(prng), v = rand(prng);
     float a = 2 * 3.14169265f * v;
     float r = sqrt(u);
-    w *= 1e9f;
+    w = w * 1e9f - peak;
 
-    float3 reflected = (float3)(r * cos(a), sqrt(1.0f - u), r * sin(a));
-    float intensity = exp(-pow(w - peak, 2) * dev);
+    float4 intensity = exp(-w * w * dev);
+    *weight = albedo * intensity + (1 - albedo);
+    return (float3)(r * cos(a), sqrt(1.0f - u), r * sin(a));
+}
+
+/* Evaluates matte_flat for a reflected ray, times the cosine term. */
+float4 matte_flat_eval(float4 w, float3 reflected, float albedo)
+{
+    return (float4)(albedo * fmax(reflected.y, 0.0f) / PI);
+}
+
+/* Evaluates matte_peak for a reflected ray, times the cosine term. */
+float4 matte_peak_eval(float4 w, float3 reflected, float peak, float dev,
+                       float albedo)
+{
+    w = w * 1e9f - peak;
+
+    float4 intensity = exp(-w * w * dev);
     intensity = albedo * intensity + (1 - albedo);
-    return (float4)(reflected, intensity);
+    return intensity * fmax(reflected.y, 0.0f) / PI;
 }
 
+/* Density with which matte_flat and matte_peak sample a reflected ray. */
+float matte_pdf(float3 reflected)
+{
+    return fmax(reflected.y, 0.0f) / PI;
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <material.cl>
+#include <volume.cl>
+#include <prng.cl>
+#include <bvh.cl>
+#include <light.cl>
+
+/** @file path.cl
+  * @brief Path vertices.
+  *
+  * This file contains what the kernels which record the vertices of their
+  * light paths (see bdpt.cl and sppm.cl) have in common, along with the float
+  * atomics they use to add samples to arbitrary pixels.
+**/
+
+/** @struct PathVertex
+  * @brief Subpath vertex.
+**/
+typedef struct PathVertex
+{
+    /** The subpath's throughput up to this vertex. **/
+    float4 beta;
+    /** The vertex's location. **/
+    float3 p;
+    /** The surface's bitangent. **/
+    float3 b;
+    /** The surface's normal, on the side the subpath came from. **/
+    float3 n;
+    /** The surface's tangent. **/
+    float3 t;
+    /** The direction the subpath came from, in TBN space. **/
+    float3 incident;
+    /** The density (per unit area) of the vertex, as sampled by its subpath. **/
+    float pdfFwd;
+    /** The density (per unit area) of the vertex, if it were sampled by the
+      * other subpath, from the next vertex.
+    **/
+    float pdfRev;
+    /** The material of the medium the subpath came from, and beyond. **/
+    uint in, to;
+    /** Whether the \c to medium is nested inside the \c in medium. **/
+    uint nested;
+    /** The material ID of the surface. **/
+    uint matID;
+    /** The index of the triangle the vertex lies on. **/
+    uint triangle;
+    /** Whether the surface's reflectance function is a Dirac delta. **/
+    uint delta;
+    /** Whether the surface emits light, which ends the subpath. **/
+    uint emitter;
+} PathVertex;
+
+/** Adds a number to a float in global memory, atomically.
+  * @param address The float's address.
+  * @param value The number to add.
+**/
+void AtomicAdd(volatile global float *address, float value)
+{
+    uint expected, desired;
+
+    do
+    {
+        expected = as_uint(*address);
+        desired = as_uint(as_float(expected) + value);
+    }
+    while (atomic_cmpxchg((volatile global uint *)address,
+                          expected, desired) != expected);
+}
+
+/** Adds a color to a pixel (or any other float4), atomically, as other
+  * work-items may be adding to it at the same time.
+  * @param pixel The pixel, in the pixel buffer.
+  * @param xyz The XYZ color to add.
+**/
+void Splat(global float4 *pixel, float3 xyz)
+{
+    AtomicAdd((volatile global float *)pixel + 0, xyz.x);
+    AtomicAdd((volatile global float *)pixel + 1, xyz.y);
+    AtomicAdd((volatile global float *)pixel + 2, xyz.z);
+}
+
+/** Transforms a world space direction into a vertex's TBN space.
+  * @param direction The direction.
+  * @param v The vertex.
+  * @returns The direction in TBN space.
+**/
+float3 VertexTBN(float3 direction, PathVertex *v)
+{
+    return (float3)(dot(direction, v->b),
+                    dot(direction, v->n),
+                    dot(direction, v->t));
+}
+
+/** Traces a ray to the next surface, and records a path vertex there, which
+  * only lacks its densities.
+  * @param origin The ray's origin.
+  * @param direction The ray's direction.
+  * @param v The vertex to record.
+  * @param beta A pointer to the path's throughput, which is attenuated by the
+  *             medium the ray goes through, and recorded in the vertex (if the
+  *             ray escapes, only a density grid on its way attenuates it).
+  * @param w The light path's wavelengths, in meters.
+  * @param prng A PRNG instance.
+  * @param matStack The media stack.
+  * @param matPos The index of the medium the ray is in, in the stack.
+  * @param distance A pointer in which to store the distance to the vertex.
+  * @param triangles The list of triangles in the scene.
+  * @param nodes The tree datastructure, as a list of nodes.
+  * @param mapping The model to material mapping.
+  * @param materials The material table, indexed by material ID.
+  * @param volumes The density grid table, see volume.cl.
+  * @param grids The densities and majorants of all grids.
+  * @returns Whether the ray hit a surface, if not, the vertex is untouched.
+**/
+bool NextVertex(float3 origin, float3 direction, PathVertex *v, float4 *beta,
+                float4 w, PRNG *prng, uint *matStack, uint matPos,
+                float *distance, global Triangle *triangles,
+                global Node *nodes, constant uint *mapping,
+                constant Material *materials, constant Volume *volumes,
+                global float *grids)
+{
+    uint hit;
+    if (!Intersect(origin, direction, distance, &hit, triangles, nodes))
+    {
+        /* A density grid still attenuates the light from the sky. */
+        if (heterogeneous(materials + matStack[matPos]))
+            *beta *= Transmittance(materials + matStack[matPos], w, origin,
+                                   direction, INFINITY, prng, volumes, grids);
+        return false;
+    }
+
+    Triangle triangle = triangles[hit];
+    uint mappingMatID = mapping[triangle.mat];
+
+    /* The medium absorbs light along the ray. */
+    *beta *= Transmittance(materials + matStack[matPos], w, origin, direction,
+                           *distance, prng, volumes, grids);
+
+    v->p = origin + (*distance) * direction;
+    v->t = triangle.t;
+    v->b = triangle.b;
+    v->n = triangle.n;
+
+    /* Flip the normal, with the bitangent, if necessary. */
+    if (dot(v->n, direction) > 0) { v->n = -v->n; v->b = -v->b; }
+
+    /* Select the right media at the interface. */
+    v->in = matStack[matPos];
+    v->to = mappingMatID;
+    v->nested = true;
+    if (mappingMatID == matStack[matPos])
+    {
+        v->to = matStack[matPos - 1];
+        v->nested = false;
+    }
+
+    v->incident = VertexTBN(direction, v);
+    v->matID = mappingMatID;
+    v->triangle = hit;
+    v->beta = *beta;
+    v->emitter = exitant(materials + mappingMatID, w,
+                         v->incident, prng).x > 0.0f;
+    v->delta = !v->emitter && !diffuse(materials + v->in,
+                                       materials + v->to, v->nested);
+    return true;
+}
+
+/** Leaves a path vertex along a reflected or transmitted ray, as returned by
+  * \c reflect, updating the media stack if the ray is transmitted.
+  * @param v The vertex.
+  * @param result The ray, in the vertex's TBN space.
+  * @param origin A pointer in which to store the ray's origin.
+  * @param matStack The media stack.
+  * @param matPos A pointer to the index of the current medium in the stack.
+  * @returns The ray's direction, in world space.
+**/
+float3 LeaveVertex(PathVertex *v, float3 result, float3 *origin,
+                   uint *matStack, uint *matPos)
+{
+    if (result.y < 0.0f)
+    {
+        /* Ray is transmitted, update the media stack. */
+        *origin = v->p - v->n * PSHBK;
+        if (v->matID == matStack[*matPos]) (*matPos)--;
+        else matStack[++(*matPos)] = v->matID;
+    }
+    else *origin = v->p + v->n * PSHBK;
+
+    /* Go back to world space. */
+    return result.x * v->b + result.y * v->n + result.z * v->t;
+}
+
+/** Starts a light subpath, by recording its first vertex at a point sampled
+  * by area on the light sources, and sampling the direction it leaves in, by
+  * cosine, on either side of the light source.
+  * @param prng A PRNG instance.
+  * @param v The vertex to record.
+  * @param w The light path's wavelengths, in meters.
+  * @param lights The light list.
+  * @param lightCount The number of entries in the light list, nonzero.
+  * @param lightArea The total area of the light sources.
+  * @param triangles The list of triangles in the scene.
+  * @param mapping The model to material mapping.
+  * @param materials The material table, indexed by material ID.
+  * @param cosine A pointer in which to store the cosine of the direction with
+  *               the light source's normal, its density being that over 2pi.
+  * @returns The direction, in world space.
+**/
+float3 EmitVertex(PRNG *prng, PathVertex *v, float4 w, global Light *lights,
+                  uint lightCount, float lightArea, global Triangle *triangles,
+                  constant uint *mapping, constant Material *materials,
+                  float *cosine)
+{
+    float3 point;
+    uint light = SampleLight(prng, lights, lightCount, triangles, &point);
+
+    v->p = point;
+    v->t = triangles[light].t;
+    v->b = triangles[light].b;
+    v->n = triangles[light].n;
+    if (rand(prng) < 0.5f) { v->n = -v->n; v->b = -v->b; }
+
+    float r1 = rand(prng), r2 = 2 * PI * rand(prng);
+    float3 local = (float3)(sqrt(r1) * cos(r2), sqrt(1 - r1),
+                            sqrt(r1) * sin(r2));
+    *cosine = local.y;
+
+    v->matID = mapping[triangles[light].mat];
+    float4 Le = exitant(materials + v->matID, w, local, prng);
+
+    /* The throughput at the vertex is the radiance over the point's density. */
+    v->beta = fmax(Le, 0.0f) * lightArea;
+    v->pdfFwd = 1.0f / lightArea;
+    v->pdfRev = 0.0f;
+    v->in = v->to = mapping[0];
+    v->nested = false;
+    v->triangle = light;
+    v->delta = false;
+    v->emitter = true;
+
+    return local.x * v->b + local.y * v->n + local.z * v->t;
+}
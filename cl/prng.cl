@@ -1,11 +1,284 @@
 #pragma once
 
+#include <util.cl>
+
 /** @file prng.cl
   * @brief Kernel PRNG implementation.
 **/
 
+/* This is set by the renderer (see the Sampler engine option). Instead of  *
+ * independent pseudorandom numbers, every sample of a pixel is then a point *
+ * of an Owen-scrambled Sobol sequence, indexed by the render pass, with one *
+ * dimension per call to rand(), so that successive passes stratify each    *
+ * other. Dimensions are drawn in pairs from shuffled (0, 2)-sequences, and *
+ * each pixel gets its own scrambling, so pixels remain uncorrelated.       */
+//#define SAMPLER_SOBOL
+
+/* This is set by the renderer (see the BlueNoise engine option), it has no *
+ * effect unless SAMPLER_SOBOL is set. All pixels then share the scrambling *
+ * and are instead given toroidal shifts, themselves from a Sobol sequence  *
+ * indexed by the pixel's Morton code, such that neighbouring pixels get    *
+ * well-spread shifts and the error is distributed as blue noise.           */
+//#define SAMPLER_BLUE_NOISE
+
+/* This is set by the renderer (see the Sampler engine option). Pseudorandom *
+ * numbers then come from Philox-4x32, a counter-based generator using only  *
+ * 32-bit multiplications, which are much faster than 64-bit arithmetic on   *
+ * most GPU's, instead of the default 64-bit generator. It has no effect if  *
+ * SAMPLER_SOBOL is set.                                                    */
+//#define SAMPLER_PHILOX
+
+/** This macro converts the upper 23 bits of a 32-bit integer to a [0..1)
+  * float, by filling in the mantissa of a float in [1..2) and subtracting 1,
+  * which avoids an integer to float conversion and a division.
+**/
+#define MANTISSA_FILL(x) (as_float(((uint)(x) >> 9) | 0x3F800000) - 1.0f)
+
+#ifdef SAMPLER_SOBOL
+
+/** This macro converts a 32-bit integer, to a [0..1) float. **/
+#define TO_UNIT(x) ((float)((x) >> 8) * (1.0f / 16777216))
+
+/** Reverses the order of the bits of an integer.
+  * @param x The integer.
+  * @returns The integer, with its bits reversed.
+**/
+uint ReverseBits(uint x)
+{
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+    x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+/** Hashes an integer, such that every bit of the input affects every bit of
+  * the output.
+  * @param x The integer.
+  * @returns The hash of the integer.
+**/
+uint Hash(uint x)
+{
+    x ^= x >> 16; x *= 0x7FEB352D;
+    x ^= x >> 15; x *= 0x846CA68B;
+    x ^= x >> 16; return x;
+}
+
+/** Performs a hash-based Owen scrambling of a fixed-point number in [0..1),
+  * where each bit is flipped depending on all of the bits above it.
+  * @param x The number, as a 32-bit fraction.
+  * @param seed The scrambling seed.
+  * @returns The scrambled number, as a 32-bit fraction.
+**/
+uint OwenScramble(uint x, uint seed)
+{
+    x = ReverseBits(x) + seed;
+    x ^= x * 0x6C50B47C;
+    x ^= x * 0xB82F1E52;
+    x ^= x * 0xC7AFE638;
+    x ^= x * 0x8D22F6E6;
+    return ReverseBits(x);
+}
+
+/** Returns a point of the first two dimensions of the Sobol sequence, which
+  * form a (0, 2)-sequence.
+  * @param index The index of the point in the sequence.
+  * @returns The point's coordinates, as 32-bit fractions.
+**/
+uint2 Sobol2D(uint index)
+{
+    uint2 point = (uint2)(ReverseBits(index), 0);
+
+    for (uint v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+        if (index & 1) point.y ^= v;
+
+    return point;
+}
+
+/** Returns a point of an Owen-scrambled Sobol (0, 2)-sequence, shuffled by
+  * also scrambling its index, so that distinct seeds give uncorrelated but
+  * equally well-stratified sequences.
+  * @param index The index of the point in the sequence.
+  * @param seed The scrambling seed.
+  * @returns The point's coordinates, as 32-bit fractions.
+**/
+uint2 ScrambledSobol2D(uint index, uint seed)
+{
+    uint2 point = Sobol2D(OwenScramble(index, seed));
+    return (uint2)(OwenScramble(point.x, Hash(seed + 1)),
+                   OwenScramble(point.y, Hash(seed + 2)));
+}
+
+/** @struct PRNG
+  * @brief Sampler internal state.
+  *
+  * This structure contains an instance of the sampler, which generates the
+  * successive dimensions of one sample of a pixel.
+**/
+typedef struct PRNG
+{
+    /** @brief The sample index, within the pixel. **/
+    uint index;
+    /** @brief The scrambling seed, common to all samples of the pixel. **/
+    uint scramble;
+    /** @brief The next dimension to be returned. **/
+    uint dimension;
+    /** @brief The next dimension, if it was generated along with the last. **/
+    float next;
+    #ifdef SAMPLER_BLUE_NOISE
+    /** @brief The pixel's Morton code, which selects its shifts. **/
+    uint cell;
+    #endif
+} PRNG;
+
+/** Returns the scrambling seed shared by every sequence of a render.
+  * @param seed A pointer to the PRNG's seed.
+  * @returns The seed's hash.
+**/
+uint SeedKey(constant ulong4 *seed)
+{
+    return Hash((uint)seed->x ^ Hash((uint)(seed->x >> 32)));
+}
+
+/** This function creates a new sampler instance, for a given sample.
+  * @param ID The ID to create the instance with (e.g. a pixel index).
+  * @param sample The sample index, the pair (ID, sample) must be unique.
+  * @param seed A pointer to the PRNG's seed.
+  * @returns The sampler instance, ready for use.
+**/
+PRNG init(ulong ID, ulong sample, constant ulong4 *seed)
+{
+    PRNG instance;
+    uint key = SeedKey(seed);
+    instance.scramble = Hash(key ^ Hash((uint)ID ^ Hash((uint)(ID >> 32))));
+
+    #ifdef SAMPLER_BLUE_NOISE
+    /* Only the pixels' sequences are shifted, see initPixel. */
+    instance.cell = 0;
+    #endif
+
+    instance.index = (uint)sample;
+    instance.dimension = 0;
+    instance.next = 0.0f;
+    return instance;
+}
+
+/** This function returns the next dimension of the sample, in [0..1).
+  * @param prng A pointer to the sampler instance to use.
+  * @returns A uniform number between 0 and 1 exclusive, stratified with the
+  *          same dimension of the pixel's other samples.
+**/
+float rand(PRNG *prng)
+{
+    /* Dimensions are generated in pairs. */
+    uint dimension = prng->dimension++;
+    if (dimension & 1) return prng->next;
+
+    /* Each pair of dimensions has its own scrambling and shuffling. */
+    uint seed = Hash(prng->scramble ^ Hash(dimension));
+    uint2 point = ScrambledSobol2D(prng->index, seed);
+
+    #ifdef SAMPLER_BLUE_NOISE
+    /* Shift the point by the pixel's own offset, modulo 1. */
+    point += ScrambledSobol2D(prng->cell, Hash(seed + 3));
+    #endif
+
+    prng->next = TO_UNIT(point.y);
+    return TO_UNIT(point.x);
+}
+
+#elif defined(SAMPLER_PHILOX)
+
+/** This indicates how many rounds are to be used by Philox-4x32, 7 is the
+  * fewest which pass all statistical tests of the TestU01 BigCrush battery,
+  * and 10 is the conventional choice, with a safety margin.
+**/
+#ifndef PHILOX_ROUNDS
+#define PHILOX_ROUNDS 7
+#endif
+
+/** Philox-4x32 counter-based pseudorandom function.
+  * @param counter The counter.
+  * @param key The key.
+  * @returns A 128-bit pseudorandom output.
+**/
+uint4 philox(uint4 counter, uint2 key)
+{
+    #pragma unroll
+    for (uint t = 0; t < PHILOX_ROUNDS; ++t)
+    {
+        uint hi0 = mul_hi(0xD2511F53u, counter.x), lo0 = 0xD2511F53u * counter.x;
+        uint hi1 = mul_hi(0xCD9E8D57u, counter.z), lo1 = 0xCD9E8D57u * counter.z;
+        counter = (uint4)(hi1 ^ counter.y ^ key.x, lo1,
+                          hi0 ^ counter.w ^ key.y, lo0);
+
+        /* Weyl sequence key schedule. */
+        key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+    }
+
+    return counter;
+}
+
+/** @struct PRNG
+  * @brief PRNG internal state.
+  *
+  * This structure contains an instance of PRNG, which is enough information to
+  * generate essentially infinitely many unbiased pseudorandom numbers.
+**/
+typedef struct PRNG
+{
+    /** @brief The counter, the last component counts the outputs so far. **/
+    uint4 counter;
+    /** @brief The last output, of which \c pointer numbers remain unused. **/
+    uint4 output;
+    /** @brief An integer indicating how much of the output has been used. **/
+    uint pointer;
+    /** @brief The key, derived from the PRNG's seed. **/
+    uint2 key;
+} PRNG;
+
+/** This function creates a new PRNG instance, for a given stream.
+  * @param ID The ID to create the PRNG instance with (e.g. a pixel index).
+  * @param sample The sample index, the pair (ID, sample) must be unique.
+  * @param seed A pointer to the PRNG's seed.
+  * @returns The PRNG instance, ready for use.
+**/
+PRNG init(ulong ID, ulong sample, constant ulong4 *seed)
+{
+    PRNG instance;
+    instance.counter = (uint4)((uint)ID, (uint)(ID >> 32), (uint)sample, 0);
+    instance.key = (uint2)((uint)seed->x, (uint)(seed->x >> 32));
+    instance.output = (uint4)(0);
+    instance.pointer = 0;
+    return instance;
+}
+
+/** This function returns a uniform pseudorandom number in [0..1).
+  * @param prng A pointer to the PRNG instance to use.
+  * @returns An unbiased uniform pseudorandom number between 0 and 1 exclusive.
+**/
+float rand(PRNG *prng)
+{
+    /* Do we need to renew? */
+    if (prng->pointer == 0)
+    {
+        prng->output = philox(prng->counter, prng->key);
+        prng->counter.w++;
+        prng->pointer = 4;
+    }
+
+    /* Return a uniform number in the desired interval. */
+    --prng->pointer;
+    if (prng->pointer == 3) return MANTISSA_FILL(prng->output.w);
+    if (prng->pointer == 2) return MANTISSA_FILL(prng->output.z);
+    if (prng->pointer == 1) return MANTISSA_FILL(prng->output.y);
+    return MANTISSA_FILL(prng->output.x);
+}
+
+#else
+
 /** This macro converts a 64-bit integer, to a [0..1) float. **/
-#define TO_FLOAT(x) ((float)x / (ulong)(18446744073709551615UL))
+#define TO_FLOAT(x) MANTISSA_FILL((x) >> 32)
 
 /** This indicates how many rounds are to be used for the one-way pseudorandom
   * function, higher means greater quality but at a higher computational cost,
@@ -74,15 +347,16 @@ typedef struct PRNG
     constant ulong4 *seed;
 } PRNG;
 
-/** This function creates a new PRNG instance, and initializes it to zero.
-  * @param ID The ID to create the PRNG instance with, must be unique.
+/** This function creates a new PRNG instance, for a given stream.
+  * @param ID The ID to create the PRNG instance with (e.g. a pixel index).
+  * @param sample The sample index, the pair (ID, sample) must be unique.
   * @param seed A pointer to the PRNG's seed.
   * @returns The PRNG instance, ready for use.
 **/
-PRNG init(ulong ID, constant ulong4 *seed)
+PRNG init(ulong ID, ulong sample, constant ulong4 *seed)
 {
     PRNG instance;
-    instance.state = (ulong4)(ID);
+    instance.state = (ulong4)(ID, sample, 0, 0);
     instance.pointer = 0;
     instance.seed = seed;
     return instance;
@@ -109,3 +383,29 @@ float rand(PRNG *prng)
     if (prng->pointer == 1) return TO_FLOAT(prng->state.y);
     return TO_FLOAT(prng->state.x);
 }
+
+#endif
+
+/** This function creates a new sampler instance, for a given sample of a
+  * pixel. With \c SAMPLER_BLUE_NOISE, all pixels then share the scrambling,
+  * and the pixel's Morton code selects its shifts instead, while its index
+  * still identifies its sequence, apart from those created by \c init for
+  * other purposes (whose IDs may well be equal to some Morton code).
+  * @param pixel The pixel's index.
+  * @param coords The pixel's coordinates.
+  * @param sample The sample index, the pair (pixel, sample) must be unique.
+  * @param seed A pointer to the PRNG's seed.
+  * @returns The sampler instance, ready for use.
+**/
+PRNG initPixel(uint pixel, uint2 coords, ulong sample,
+               constant ulong4 *seed)
+{
+    PRNG instance = init(pixel, sample, seed);
+
+    #if defined(SAMPLER_SOBOL) && defined(SAMPLER_BLUE_NOISE)
+    instance.scramble = SeedKey(seed);
+    instance.cell = Morton2D(coords);
+    #endif
+
+    return instance;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <util.cl>
+#include <prng.cl>
+#include <material.cl>
+
+/** @file sky.cl
+  * @brief Environment lighting.
+  *
+  * The sky is a latitude-longitude map, with the zenith along the y-axis, of
+  * which each texel holds the strengths of the sky's and the sun's black body
+  * spectra, and its density when directions are sampled by \c SampleSky. The
+  * renderer also provides the marginal cumulative distribution of the rows,
+  * followed by the conditional cumulative distribution of each row's texels.
+**/
+
+/** @struct Sky
+  * @brief Sky parameters.
+**/
+typedef struct Sky
+{
+    /** The black body temperature of the sky. **/
+    float skyTemperature;
+    /** The black body temperature of the sun. **/
+    float sunTemperature;
+    /** The width of the sky map, or zero if there is no sky. **/
+    uint width;
+    /** The height of the sky map, half of its width. **/
+    uint height;
+} Sky;
+
+/** Returns the texel of the sky map containing a direction.
+  * @param direction The direction, as a unit vector.
+  * @param sky The sky parameters.
+  * @returns The texel's index in the sky map.
+**/
+uint SkyTexel(float3 direction, constant Sky *sky)
+{
+    float theta = acos(clamp(direction.y, -1.0f, 1.0f));
+    float phi = atan2(direction.z, direction.x);
+    if (phi < 0.0f) phi += 2 * PI;
+
+    uint i = min((uint)(theta / PI * sky->height), sky->height - 1);
+    uint j = min((uint)(phi / (2 * PI) * sky->width), sky->width - 1);
+    return i * sky->width + j;
+}
+
+/** Returns the radiance coming from the sky in some direction.
+  * @param direction The direction, as a unit vector.
+  * @param wavelengths The wavelengths, in meters.
+  * @param map The sky map.
+  * @param sky The sky parameters.
+  * @returns The radiance at each wavelength.
+**/
+float4 SkyRadiance(float3 direction, float4 wavelengths, global float4 *map,
+                   constant Sky *sky)
+{
+    if (sky->width == 0) return (float4)(0.0f);
+
+    float4 texel = map[SkyTexel(direction, sky)];
+    return texel.x * blackbody(wavelengths, sky->skyTemperature)
+         + texel.y * blackbody(wavelengths, sky->sunTemperature);
+}
+
+/** Returns the density (per solid angle) with which \c SampleSky samples a
+  * direction.
+  * @param direction The direction, as a unit vector.
+  * @param map The sky map.
+  * @param sky The sky parameters.
+  * @returns The density of the direction.
+**/
+float SkyDensity(float3 direction, global float4 *map, constant Sky *sky)
+{
+    if (sky->width == 0) return 0.0f;
+    return map[SkyTexel(direction, sky)].z;
+}
+
+/** Finds the first entry of a cumulative distribution above some number.
+  * @param u A uniform number in [0..1).
+  * @param cdf The cumulative distribution, of which the last entry is one.
+  * @param count The number of entries.
+  * @returns The entry's index.
+**/
+uint SkySearch(float u, global float *cdf, uint count)
+{
+    uint lo = 0, hi = count - 1;
+    while (lo < hi)
+    {
+        uint mid = (lo + hi) / 2;
+        if (cdf[mid] <= u) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+/** Samples a direction towards the sky, with a density proportional to the
+  * visible power of the sky map's texels, and uniform within each texel.
+  * @param prng A PRNG instance.
+  * @param map The sky map.
+  * @param cdf The sky map's cumulative distributions.
+  * @param sky The sky parameters, with a sky.
+  * @param pdf A pointer in which to store the direction's density.
+  * @returns The sampled direction, as a unit vector.
+**/
+float3 SampleSky(PRNG *prng, global float4 *map, global float *cdf,
+                 constant Sky *sky, float *pdf)
+{
+    /* Select a row, then a texel in that row. */
+    uint i = SkySearch(rand(prng), cdf, sky->height);
+    uint j = SkySearch(rand(prng), cdf + sky->height + i * sky->width,
+                       sky->width);
+    *pdf = map[i * sky->width + j].z;
+
+    /* Then a direction in the texel, uniformly over its solid angle. */
+    float cos0 = cos(PI * i / sky->height);
+    float cos1 = cos(PI * (i + 1) / sky->height);
+    float cosTheta = mix(cos0, cos1, rand(prng));
+    float sinTheta = sqrt(fmax(1.0f - cosTheta * cosTheta, 0.0f));
+    float phi = 2 * PI * (j + rand(prng)) / sky->width;
+
+    return (float3)(sinTheta * cos(phi), cosTheta, sinTheta * sin(phi));
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <util.cl>
+
+/** @file sort.cl
+  * @brief Work-group sorting primitives.
+  *
+  * These functions redistribute work among the work-items of a work-group, via
+  * local memory, such that neighbouring work-items end up processing similar
+  * work. All of them contain barriers, so they must be reached by every single
+  * work-item of the work-group, including those which have nothing left to do.
+**/
+
+/** Largest work-group size the local memory arrays are dimensioned for, this
+  * is normally provided by the renderer, which launches the kernel with work
+  * groups no larger than this.
+**/
+#ifndef LOCAL_SIZE_MAX
+#define LOCAL_SIZE_MAX 128
+#endif
+
+/** Number of distinct keys (bins) supported by \c CountingSort. **/
+#define SORT_BINS 16
+
+/* The bins' counts are packed in eight bits each, see CountingSortAt. */
+#if LOCAL_SIZE_MAX > 255
+#error "Work groups are too large for the sorting primitives."
+#endif
+
+/** Number of key bits sorted by each pass of \c RadixSort. **/
+#define SORT_RADIX_BITS 4
+
+/** Returns the count of a bin, from counts packed in eight bits per bin.
+  * @param counts The packed counts, the first four bins in the x-component.
+  * @param bin The bin, less than \c SORT_BINS.
+  * @returns The bin's count.
+**/
+uint BinCount(uint4 counts, uint bin)
+{
+    uint c = (bin < 8) ? ((bin < 4) ? counts.x : counts.y)
+                       : ((bin < 12) ? counts.z : counts.w);
+    return (c >> ((bin & 3) * 8)) & 0xFF;
+}
+
+/** Performs a parallel counting sort of one key per work-item, over the whole
+  * work-group, where the work-items are in a given order rather than in the
+  * order of their local ID's. The sort is stable.
+  *
+  * Every work-item counts itself in its key's bin, with the counts of all the
+  * bins packed in eight bits each (which the work-group size can't overflow),
+  * and a prefix sum of these over the work-items' positions then gives each
+  * work-item both its rank among those with the same key and the histogram,
+  * in as many steps as there are bits in the work-group size.
+  * @param key The work-item's key, which must be less than \c SORT_BINS.
+  * @param position The work-item's current position, unique in the group.
+  * @param keys A local array of \c LOCAL_SIZE_MAX elements.
+  * @param bins A local array of \c SORT_BINS elements, which holds the first
+  *             position of each bin in the sorted sequence afterwards.
+  * @returns The work-item's position in the sorted sequence.
+**/
+uint CountingSortAt(uint key, uint position, local uint4 *keys,
+                    local uint *bins)
+{
+    uint lid = LocalID(), size = LocalSize();
+
+    uint4 count = (uint4)(0);
+    if (key < 4) count.x = 1 << (key * 8);
+    else if (key < 8) count.y = 1 << ((key - 4) * 8);
+    else if (key < 12) count.z = 1 << ((key - 8) * 8);
+    else count.w = 1 << ((key - 12) * 8);
+
+    /* Inclusive prefix sum of the counts, by position (Hillis-Steele). */
+    keys[position] = count;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint offset = 1; offset < size; offset <<= 1)
+    {
+        uint4 before = (position >= offset) ? keys[position - offset]
+                                            : (uint4)(0);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        keys[position] += before;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    /* The last position holds the histogram, of which the bins before    *
+     * ours give where it starts, and the prefix sum gives our rank in it. */
+    uint4 histogram = keys[size - 1];
+    uint slot = BinCount(keys[position], key) - 1;
+    for (uint t = 0; t < key; ++t) slot += BinCount(histogram, t);
+
+    for (uint b = lid; b < SORT_BINS; b += size)
+    {
+        uint start = 0;
+        for (uint t = 0; t < b; ++t) start += BinCount(histogram, t);
+        bins[b] = start;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    return slot;
+}
+
+/** Performs a parallel counting sort of one key per work-item, over the whole
+  * work-group. The sort is stable, so work-items with equal keys retain their
+  * relative order.
+  * @param key The work-item's key, which must be less than \c SORT_BINS.
+  * @param keys A local array of \c LOCAL_SIZE_MAX elements.
+  * @param bins A local array of \c SORT_BINS elements.
+  * @returns The work-item's position in the sorted sequence, between zero and
+  *          the work-group size exclusive, unique within the work-group.
+**/
+uint CountingSort(uint key, local uint4 *keys, local uint *bins)
+{
+    return CountingSortAt(key, LocalID(), keys, bins);
+}
+
+/** Performs a parallel least significant digit radix sort of one key per
+  * work-item, over the whole work-group, as a sequence of counting sorts, one
+  * per \c SORT_RADIX_BITS bits of the keys, each of which costs as much as a
+  * \c CountingSort, so keys should be kept as short as possible.
+  * @param key The work-item's key.
+  * @param bits The number of significant bits in the keys.
+  * @param keys A local array of \c LOCAL_SIZE_MAX elements.
+  * @param bins A local array of \c SORT_BINS elements.
+  * @returns The work-item's position in the sorted sequence, between zero and
+  *          the work-group size exclusive, unique within the work-group.
+**/
+uint RadixSort(uint key, uint bits, local uint4 *keys, local uint *bins)
+{
+    uint position = LocalID();
+
+    for (uint shift = 0; shift < bits; shift += SORT_RADIX_BITS)
+    {
+        uint digit = (key >> shift) & (SORT_BINS - 1);
+        position = CountingSortAt(digit, position, keys, bins);
+    }
+
+    return position;
+}
+
+/** Returns whether a predicate holds for any work-item in the work-group.
+  * @param predicate The work-item's predicate.
+  * @param flag A local variable used for the reduction.
+  * @returns The same value for every work-item, \c true if at least one of
+  *          them passed a \c true predicate, \c false otherwise.
+**/
+bool GroupAny(bool predicate, local uint *flag)
+{
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (LocalID() == 0) *flag = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (predicate) atomic_or(flag, 1);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    return (*flag != 0);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+/** @file spectral.cl
+  * @brief Color-matching curve lookup and wavelength sampling.
+  *
+  * The renderer uploads the color-matching curve as a table of evenly spaced
+  * wavelengths over the visible spectrum, each entry holding the XYZ color of
+  * its wavelength and, in the w-component, the cumulative distribution of the
+  * density with which wavelengths are sampled, up to that wavelength. Here,
+  * wavelengths are normalized, 0 being 380nm and 1 being 780nm.
+**/
+
+/** Number of entries in the table, this is normally provided by the renderer.
+**/
+#ifndef SPECTRAL_RESOLUTION
+#define SPECTRAL_RESOLUTION 81
+#endif
+
+/** Number of intervals between successive entries of the table. **/
+#define SPECTRAL_BINS (SPECTRAL_RESOLUTION - 1)
+
+/** Returns the XYZ color of a wavelength, interpolating linearly between the
+  * entries of the table.
+  * @param wavelength The normalized wavelength.
+  * @param spectrum The color-matching curve table.
+  * @returns The XYZ color of the wavelength.
+**/
+float3 SpectrumXYZ(float wavelength, constant float4 *spectrum)
+{
+    float x = clamp(wavelength, 0.0f, 1.0f) * SPECTRAL_BINS;
+    uint bin = min((uint)x, (uint)SPECTRAL_BINS - 1);
+    return mix(spectrum[bin].xyz, spectrum[bin + 1].xyz, x - bin);
+}
+
+/** Returns the XYZ color of a spectral sample, the sum of the colors of its
+  * wavelengths, each weighted by the radiance at that wavelength.
+  * @param wavelengths The normalized wavelengths.
+  * @param radiance The radiance at each wavelength.
+  * @param spectrum The color-matching curve table.
+  * @returns The XYZ color of the sample.
+**/
+float3 SpectralColor(float4 wavelengths, float4 radiance,
+                     constant float4 *spectrum)
+{
+    return SpectrumXYZ(wavelengths.x, spectrum) * radiance.x
+         + SpectrumXYZ(wavelengths.y, spectrum) * radiance.y
+         + SpectrumXYZ(wavelengths.z, spectrum) * radiance.z
+         + SpectrumXYZ(wavelengths.w, spectrum) * radiance.w;
+}
+
+/** Samples a wavelength, with a density piecewise constant between entries of
+  * the table, by inverting its cumulative distribution.
+  * @param u A uniform number in [0..1).
+  * @param spectrum The color-matching curve table.
+  * @param pdf A pointer in which to store the density of the wavelength.
+  * @returns The normalized wavelength.
+**/
+float SampleWavelength(float u, constant float4 *spectrum, float *pdf)
+{
+    /* Find the interval containing u, by binary search. */
+    uint lo = 0, hi = SPECTRAL_BINS;
+    while (hi - lo > 1)
+    {
+        uint mid = (lo + hi) / 2;
+        if (spectrum[mid].w <= u) lo = mid;
+        else hi = mid;
+    }
+
+    float c0 = spectrum[lo].w, c1 = spectrum[hi].w;
+    *pdf = (c1 - c0) * SPECTRAL_BINS;
+    return (lo + (u - c0) / (c1 - c0)) / SPECTRAL_BINS;
+}
+
+/** Samples four wavelengths at once, see \c SampleWavelength.
+  * @param u Four uniform numbers in [0..1).
+  * @param spectrum The color-matching curve table.
+  * @param pdf A pointer in which to store the density of each wavelength.
+  * @returns The normalized wavelengths.
+**/
+float4 SampleWavelengths(float4 u, constant float4 *spectrum, float4 *pdf)
+{
+    float4 wavelengths;
+    float p0, p1, p2, p3;
+    wavelengths.x = SampleWavelength(u.x, spectrum, &p0);
+    wavelengths.y = SampleWavelength(u.y, spectrum, &p1);
+    wavelengths.z = SampleWavelength(u.z, spectrum, &p2);
+    wavelengths.w = SampleWavelength(u.w, spectrum, &p3);
+    *pdf = (float4)(p0, p1, p2, p3);
+    return wavelengths;
+}
@@ -0,0 +1,457 @@
+#pragma once
+
+#include <path.cl>
+
+/** @file sppm.cl
+  * @brief Stochastic progressive photon mapping kernel.
+  *
+  * This file is included by epsilon.cl in SPPM mode, and uses its definitions.
+  * Each render pass is an SPPM iteration, in three stages, which the renderer
+  * launches one after the other (see \c PhotonMap):
+  * - \c SPPM_STAGE_VISIBLE: a camera path is traced through each pixel, to a
+  *   diffuse surface (its visible point), which is inserted into a hash grid.
+  * - \c SPPM_STAGE_PHOTONS: photons are traced from the light sources, and at
+  *   each diffuse surface, they add their flux to the visible points nearby.
+  * - \c SPPM_STAGE_UPDATE: each pixel's gathering radius shrinks with the
+  *   photons it gathered, and its estimate is written to the pixel buffer.
+  *
+  * All paths of an iteration share the same wavelengths, so that photons can
+  * be gathered by any visible point, and only the XYZ colors of the photons'
+  * contributions are accumulated, across iterations.
+**/
+
+/** The radius shrinking parameter, the fraction of the photons gathered by a
+  * pixel at each iteration which are kept in its estimate.
+**/
+#ifndef SPPM_ALPHA
+#define SPPM_ALPHA 0.7f
+#endif
+
+/** Maximum number of surface interactions of camera paths and photons. **/
+#ifndef SPPM_DEPTH
+#define SPPM_DEPTH 16
+#endif
+
+/** The number of photons traced at each iteration, set by the renderer. **/
+#ifndef SPPM_PHOTONS
+#define SPPM_PHOTONS (RENDER_WIDTH * RENDER_HEIGHT)
+#endif
+
+/** The initial gathering radius, as a fraction of the diagonal of the scene's
+  * bounding box, set by the renderer.
+**/
+#ifndef SPPM_RADIUS
+#define SPPM_RADIUS 0.005f
+#endif
+
+/** The stages of an iteration, see above. **/
+#define SPPM_STAGE_VISIBLE 0
+#define SPPM_STAGE_PHOTONS 1
+#define SPPM_STAGE_UPDATE  2
+
+/** @struct VisiblePoint
+  * @brief Camera path vertex at which photons are gathered.
+**/
+typedef struct VisiblePoint
+{
+    /** The camera path's throughput up to the visible point. **/
+    float4 beta;
+    /** The visible point's location. **/
+    float4 p;
+    /** The surface's bitangent, normal (on the camera's side) and tangent. **/
+    float4 b, n, t;
+    /** The direction the camera path came from, in TBN space. **/
+    float4 incident;
+    /** The media on either side of the surface, and whether they are nested
+      * (the w-component is unused, the point is only found through the grid).
+    **/
+    uint4 media;
+} VisiblePoint;
+
+/** @struct PhotonStats
+  * @brief Per-pixel photon mapping statistics.
+**/
+typedef struct PhotonStats
+{
+    /** The XYZ flux of the photons gathered during this iteration. **/
+    float4 flux;
+    /** The XYZ flux of all photons kept so far, and their number. **/
+    float4 tau;
+    /** The XYZ radiance seen directly along the camera paths, summed. **/
+    float4 direct;
+    /** The squared gathering radius, zero before the first iteration. **/
+    float radius2;
+    /** The number of photons gathered during this iteration. **/
+    uint count;
+} PhotonStats;
+
+/** Returns the normalized wavelengths shared by all paths of an iteration.
+  * @param first The iteration, as the index of the pass.
+  * @param seed The PRNG's seed.
+  * @param spectrum The tristimulus curve and wavelength distribution.
+  * @param pdf A pointer in which to store the density of each wavelength.
+  * @returns The normalized wavelengths.
+**/
+float4 IterationWavelengths(uint first, constant ulong4 *seed,
+                            constant float4 *spectrum, float4 *pdf)
+{
+    PRNG prng = init((ulong)-1, first, seed);
+    float4 u = rand(&prng) + (float4)(0.0f, 0.25f, 0.5f, 0.75f);
+    return SampleWavelengths(u - floor(u), spectrum, pdf);
+}
+
+/** Returns the initial gathering radius of every pixel, which is also half
+  * of the side of the hash grid's cells, as radii only shrink.
+  * @param nodes The BVH nodes, the first of which bounds the whole scene.
+  * @returns The radius.
+**/
+float InitialRadius(global Node *nodes)
+{
+    return SPPM_RADIUS * length(nodes[0].max.xyz - nodes[0].min.xyz);
+}
+
+/** Returns the hash grid cell containing a point.
+  * @param p The point.
+  * @param nodes The BVH nodes, the first of which bounds the whole scene.
+  * @returns The cell's coordinates.
+**/
+int3 GridCell(float3 p, global Node *nodes)
+{
+    float side = 2 * InitialRadius(nodes);
+    return convert_int3(floor((p - nodes[0].min.xyz) / side));
+}
+
+/** Returns the hash grid bucket of a cell.
+  * @param c The cell's coordinates.
+  * @param cells The number of buckets.
+  * @returns The bucket.
+**/
+uint GridBucket(int3 c, uint cells)
+{
+    return (((uint)c.x * 73856093u) ^ ((uint)c.y * 19349663u)
+                                    ^ ((uint)c.z * 83492791u)) % cells;
+}
+
+/** Inserts a visible point into the hash grid, in every cell its gathering
+  * radius overlaps (at most eight, as the radius is at most half a cell).
+  * @param pixel The visible point's pixel.
+  * @param p The visible point's location.
+  * @param radius The gathering radius.
+  * @param grid The first entry of each bucket's list, followed by the number
+  *             of entries in all lists.
+  * @param entries The entries, each being a pixel and the next entry.
+  * @param nodes The BVH nodes, the first of which bounds the whole scene.
+  * @param cells The number of buckets.
+**/
+void GridInsert(uint pixel, float3 p, float radius, global uint *grid,
+                global uint2 *entries, global Node *nodes, uint cells)
+{
+    int3 lo = GridCell(p - radius, nodes), hi = GridCell(p + radius, nodes);
+
+    for (int z = lo.z; z <= hi.z; ++z)
+        for (int y = lo.y; y <= hi.y; ++y)
+            for (int x = lo.x; x <= hi.x; ++x)
+            {
+                uint bucket = GridBucket((int3)(x, y, z), cells);
+                uint entry = atomic_inc(grid + cells);
+                entries[entry] = (uint2)(pixel, atomic_xchg(grid + bucket,
+                                                            entry));
+            }
+}
+
+/** Traces a camera path through each pixel, to its visible point, which it
+  * inserts into the hash grid, and sums the light seen directly on the way.
+  * The arguments are those of \c clsppm, along with the wavelengths of the
+  * iteration and their densities.
+**/
+void VisibleStage(global PhotonStats *stats, global VisiblePoint *points,
+                  global uint *grid, global uint2 *entries,
+                  float4 wavelengths, float4 w_pdf,
+                  constant Params *params, global uint *pixels,
+                  constant float4 *spectrum, global Triangle *triangles,
+                  global Node *nodes, constant uint *mapping,
+                  constant Material *materials, constant Volume *volumes,
+                  global float *grids, global float4 *skyMap,
+                  constant Sky *sky, constant Camera *camera,
+                  constant ulong4 *seed, uint first, global uint *counter)
+{
+    /* Pixels assigned to this worker, persistent workers fetch their own. */
+    #ifdef KERNEL_MODE_PERSISTENT
+    uint next = 0, last = 0;
+    #else
+    uint next = GlobalID(), last = next + 1;
+    #endif
+
+    uint cells = RENDER_WIDTH * RENDER_HEIGHT;
+    float4 w_m = (wavelengths * 400 + 380) * 1e-9f;
+    float radius = InitialRadius(nodes);
+    uint pixel;
+    uint2 coords;
+
+    while (NextPixel(&pixel, &coords, &next, &last, counter, pixels, params))
+    {
+        PRNG prng = initPixel(pixel, coords, first, seed);
+
+        global PhotonStats *stat = stats + pixel;
+        global VisiblePoint *point = points + pixel;
+        if (stat->radius2 == 0.0f) stat->radius2 = radius * radius;
+
+        /* Media stack, starting in the atmosphere. */
+        uint matStack[MT];
+        uint matPos = 0;
+        matStack[0] = mapping[0];
+
+        float3 origin, direction;
+        CameraRay(coords, &prng, params, camera, &origin, &direction);
+
+        float4 beta = (float4)(1.0f), radiance = (float4)(0.0f);
+        PathVertex v;
+
+        for (uint depth = 0; depth < SPPM_DEPTH; ++depth)
+        {
+            float t_d;
+            if (!NextVertex(origin, direction, &v, &beta, w_m, &prng,
+                            matStack, matPos, &t_d, triangles, nodes,
+                            mapping, materials, volumes, grids))
+            {
+                radiance += beta * SkyRadiance(direction, w_m, skyMap, sky);
+                break;
+            }
+
+            if (v.emitter)
+            {
+                radiance += beta * exitant(materials + v.matID, w_m,
+                                           v.incident, &prng);
+                break;
+            }
+
+            if (!v.delta)
+            {
+                /* Photons are gathered at the first diffuse surface. */
+                point->beta = beta;
+                point->p = (float4)(v.p, 0.0f);
+                point->b = (float4)(v.b, 0.0f);
+                point->n = (float4)(v.n, 0.0f);
+                point->t = (float4)(v.t, 0.0f);
+                point->incident = (float4)(v.incident, 0.0f);
+                point->media = (uint4)(v.in, v.to, v.nested, 0);
+
+                GridInsert(pixel, v.p, sqrt(stat->radius2), grid, entries,
+                           nodes, cells);
+                break;
+            }
+
+            float4 weight; float pdf;
+            float3 result = reflect(materials + v.in, materials + v.to, w_m,
+                                    v.incident, &prng, v.nested, &weight,
+                                    &pdf);
+
+            /* Russian roulette, as in the main kernel. */
+            beta *= weight;
+            if (!Roulette(&prng, &beta, 1.0f, depth)) break;
+
+            direction = LeaveVertex(&v, result, &origin, matStack, &matPos);
+        }
+
+        stat->direct.xyz += SpectralColor(wavelengths, radiance / w_pdf,
+                                          spectrum) * 0.25f;
+    }
+}
+
+/** Adds a photon's flux to the visible points around a diffuse surface.
+  * @param v The photon's vertex on the surface.
+  * @param direction The direction the photon came in, in world space.
+  * The other arguments are those of \c PhotonStage.
+**/
+void Gather(PathVertex *v, float3 direction, float4 wavelengths,
+            float4 w_pdf, global PhotonStats *stats,
+            global VisiblePoint *points, global uint *grid,
+            global uint2 *entries, global Node *nodes, uint cells,
+            constant float4 *spectrum, constant Material *materials)
+{
+    float4 w_m = (wavelengths * 400 + 380) * 1e-9f;
+    uint entry = grid[GridBucket(GridCell(v->p, nodes), cells)];
+
+    /* The bucket may hold visible points from other cells too. */
+    for (; entry != (uint)-1; entry = entries[entry].y)
+    {
+        uint pixel = entries[entry].x;
+        global VisiblePoint *point = points + pixel;
+
+        float3 d = point->p.xyz - v->p;
+        if (dot(d, d) > stats[pixel].radius2) continue;
+
+        /* The photon must arrive on the camera's side of the surface. */
+        float3 reflected = (float3)(dot(-direction, point->b.xyz),
+                                    dot(-direction, point->n.xyz),
+                                    dot(-direction, point->t.xyz));
+        if (reflected.y <= 0.0f) continue;
+
+        constant Material *in = materials + point->media.x;
+        constant Material *to = materials + point->media.y;
+        float4 f = evaluate(in, to, w_m, point->incident.xyz, reflected,
+                            point->media.z) / reflected.y;
+
+        float4 phi = point->beta * f * v->beta;
+        if (all(phi == (float4)(0.0f))) continue;
+
+        Splat(&stats[pixel].flux, SpectralColor(wavelengths, phi / w_pdf,
+                                                spectrum) * 0.25f);
+        atomic_inc(&stats[pixel].count);
+    }
+}
+
+/** Traces photons from the light sources, and gathers them at every diffuse
+  * surface they reach. The arguments are those of \c clsppm, along with the
+  * wavelengths of the iteration and their densities.
+**/
+void PhotonStage(global PhotonStats *stats, global VisiblePoint *points,
+                 global uint *grid, global uint2 *entries,
+                 float4 wavelengths, float4 w_pdf, constant Params *params,
+                 constant float4 *spectrum, global Triangle *triangles,
+                 global Node *nodes, global Light *lights, uint lightCount,
+                 float lightArea, constant uint *mapping,
+                 constant Material *materials, constant Volume *volumes,
+                 global float *grids, constant ulong4 *seed, uint first)
+{
+    uint id = get_global_id(0);
+    if ((id >= SPPM_PHOTONS) || (lightCount == 0)) return;
+
+    uint cells = RENDER_WIDTH * RENDER_HEIGHT;
+    float4 w_m = (wavelengths * 400 + 380) * 1e-9f;
+
+    /* Photons take the IDs after the pixels'. */
+    PRNG prng = init((ulong)cells + id, first, seed);
+
+    /* Media stack, starting in the atmosphere. */
+    uint matStack[MT];
+    uint matPos = 0;
+    matStack[0] = mapping[0];
+
+    PathVertex v;
+    float cosine;
+    float3 direction = EmitVertex(&prng, &v, w_m, lights, lightCount,
+                                  lightArea, triangles, mapping, materials,
+                                  &cosine);
+    float3 origin = v.p + v.n * PSHBK;
+    float4 beta = v.beta * 2 * PI;
+
+    /* Russian roulette compares the throughput against the initial one. */
+    float start = max(max(beta.x, beta.y), max(beta.z, beta.w));
+
+    for (uint depth = 0; depth < SPPM_DEPTH; ++depth)
+    {
+        float t_d;
+        if (!NextVertex(origin, direction, &v, &beta, w_m, &prng,
+                        matStack, matPos, &t_d, triangles, nodes,
+                        mapping, materials, volumes, grids) || v.emitter)
+            break;
+
+        if (!v.delta)
+            Gather(&v, direction, wavelengths, w_pdf, stats, points, grid,
+                   entries, nodes, cells, spectrum, materials);
+
+        float4 weight; float pdf;
+        float3 result = reflect(materials + v.in, materials + v.to, w_m,
+                                v.incident, &prng, v.nested, &weight, &pdf);
+
+        /* Russian roulette, as in the main kernel. */
+        beta *= weight;
+        if (!Roulette(&prng, &beta, start, depth)) break;
+
+        direction = LeaveVertex(&v, result, &origin, matStack, &matPos);
+    }
+}
+
+/** Shrinks each pixel's radius, writes its estimate to the pixel buffer, and
+  * empties the hash grid for the next iteration. The arguments are those of
+  * \c clsppm.
+**/
+void UpdateStage(global float4 *buffer, global PhotonStats *stats,
+                 global uint *grid, constant Params *params, uint first)
+{
+    uint index = get_global_id(0);
+    uint cells = RENDER_WIDTH * RENDER_HEIGHT;
+    if (index >= cells) return;
+
+    grid[index] = (uint)-1;
+    if (index == 0) grid[cells] = 0;
+
+    global PhotonStats *stat = stats + index;
+    if (stat->count > 0)
+    {
+        /* Keep a fraction of the new photons, in a smaller radius. */
+        float n = stat->tau.w, m = stat->count;
+        float kept = n + SPPM_ALPHA * m;
+        float radius2 = stat->radius2 * kept / (n + m);
+
+        stat->tau.xyz = (stat->tau.xyz + stat->flux.xyz)
+                      * radius2 / stat->radius2;
+        stat->tau.w = kept;
+        stat->radius2 = radius2;
+    }
+
+    stat->flux = (float4)(0.0f);
+    stat->count = 0;
+
+    /* The pixel buffer holds the sum of the estimates of all iterations. */
+    float iterations = first + 1;
+    float3 gathered = stat->tau.xyz / (PI * stat->radius2 * SPPM_PHOTONS);
+    buffer[index] = (float4)(stat->direct.xyz + gathered, iterations);
+}
+
+/** This is the SPPM kernel, which takes the same arguments as \c clmain, see
+  * there, along with the photon map's (see \c PhotonMap), and runs one of the
+  * stages of an iteration.
+  * @param stats The photon mapping statistics of each pixel.
+  * @param points The visible point of each pixel.
+  * @param grid The hash grid's buckets, see \c GridInsert.
+  * @param entries The hash grid's entries, see \c GridInsert.
+  * @param stage The stage to run.
+**/
+void kernel clsppm(   global   float4        *buffer,
+                    constant   Params        *params,
+                      global   float        *moments,
+                      global   uint          *pixels,
+                      global   float4     *splitting,
+                    constant   float4      *spectrum,
+                      global   Triangle   *triangles,
+                      global   Node           *nodes,
+                      global   Light         *lights,
+                      global   LightNode  *lightTree,
+                                   uint        lightCount,
+                                   float        lightArea,
+                    constant   uint         *mapping,
+                    constant   Material   *materials,
+                    constant   Volume       *volumes,
+                      global   float          *grids,
+                      global   float4         *skyMap,
+                      global   float          *skyCdf,
+                    constant   Sky               *sky,
+                    constant   Camera        *camera,
+                      global   PhotonStats    *stats,
+                      global   VisiblePoint  *points,
+                      global   uint            *grid,
+                      global   uint2        *entries,
+                                   uint            stage,
+                    constant   ulong4          *seed,
+                                   uint             first,
+                                   uint             count,
+                      global   uint         *counter)
+{
+    float4 w_pdf;
+    float4 wavelengths = IterationWavelengths(first, seed, spectrum, &w_pdf);
+
+    if (stage == SPPM_STAGE_VISIBLE)
+        VisibleStage(stats, points, grid, entries, wavelengths, w_pdf,
+                     params, pixels, spectrum, triangles, nodes, mapping,
+                     materials, volumes, grids, skyMap, sky, camera, seed,
+                     first, counter);
+    else if (stage == SPPM_STAGE_PHOTONS)
+        PhotonStage(stats, points, grid, entries, wavelengths, w_pdf,
+                    params, spectrum, triangles, nodes, lights, lightCount,
+                    lightArea, mapping, materials, volumes, grids, seed,
+                    first);
+    else
+        UpdateStage(buffer, stats, grid, params, first);
+}
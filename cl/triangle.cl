@@ -25,6 +25,8 @@ typedef struct Triangle
     float3 n;
     /** The triangle's material ID. **/
     uint mat;
+    /** The triangle's trail in the light tree, if it is emissive. **/
+    uint light;
 } Triangle;
 
 /** Performs an intersection test between a ray and a triangle.
@@ -28,6 +28,67 @@
 /** This is the PI constant, ratio of a circle's circumference to radius. **/
 #define PI 3.14159265f
 
+/** Returns the work-item's global ID, flattened over both dimensions.
+**/
+uint GlobalID()
+{
+    return get_global_id(1) * get_global_size(0) + get_global_id(0);
+}
+
+/** Returns the work-item's local ID, flattened over both dimensions.
+**/
+uint LocalID()
+{
+    return get_local_id(1) * get_local_size(0) + get_local_id(0);
+}
+
+/** Returns the size of the work-group, over both dimensions.
+**/
+uint LocalSize()
+{
+    return get_local_size(1) * get_local_size(0);
+}
+
+/** Encodes 3D coordinates into a Morton (Z-order) code.
+  * @param c The coordinates, each of them up to 10 bits.
+  * @returns The Morton code, with the bits of x, y and z interleaved.
+**/
+uint Morton3D(uint3 c)
+{
+    c = (c | (c << 16)) & 0x030000FF;
+    c = (c | (c <<  8)) & 0x0300F00F;
+    c = (c | (c <<  4)) & 0x030C30C3;
+    c = (c | (c <<  2)) & 0x09249249;
+    return c.x | (c.y << 1) | (c.z << 2);
+}
+
+/** Encodes 2D coordinates into a Morton (Z-order) code.
+  * @param c The coordinates, each of them up to 16 bits.
+  * @returns The Morton code, with x in the even bits and y in the odd bits.
+**/
+uint Morton2D(uint2 c)
+{
+    c = (c | (c << 8)) & 0x00FF00FF;
+    c = (c | (c << 4)) & 0x0F0F0F0F;
+    c = (c | (c << 2)) & 0x33333333;
+    c = (c | (c << 1)) & 0x55555555;
+    return c.x | (c.y << 1);
+}
+
+/** Decodes a Morton (Z-order) code into its 2D coordinates.
+  * @param code The Morton code, with x in the even bits and y in the odd bits.
+  * @returns The coordinates, each of them up to 16 bits.
+**/
+uint2 Morton(uint code)
+{
+    uint2 c = (uint2)(code, code >> 1) & 0x55555555;
+    c = (c | (c >> 1)) & 0x33333333;
+    c = (c | (c >> 2)) & 0x0F0F0F0F;
+    c = (c | (c >> 4)) & 0x00FF00FF;
+    c = (c | (c >> 8)) & 0x0000FFFF;
+    return c;
+}
+
 /** Computes the amplitude reflection coefficient for s-polarized light.
   * @param n1 The incoming medium's refractive index.
   * @param n2 The outgoing medium's refractive index.
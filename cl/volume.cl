@@ -0,0 +1,285 @@
+#pragma once
+
+#include <material.cl>
+#include <prng.cl>
+
+/** @file volume.cl
+  * @brief Heterogeneous media.
+  *
+  * A medium may have a density grid (see the material's \c volume), which
+  * scales its absorption coefficient at every point within the grid's bounds,
+  * the density being zero outside of them. The voxels are grouped into coarse
+  * cells, of which the renderer stores the largest density, so light is tracked
+  * through the medium against a majorant which is only as large as the cell
+  * it is in requires, and empty cells are stepped over entirely. Every grid's
+  * densities and majorants are in a single buffer, with x varying fastest.
+**/
+
+/** Whether any of the scene's media has a density grid. When the kernel is
+  * specialized, the renderer sets this, and if none does, the tracking below
+  * is compiled out, and all media are homogeneous.
+**/
+#ifndef SCENE_VOLUMES
+#define SCENE_VOLUMES 1
+#endif
+
+/** @brief Voxels along each side of a majorant cell, as in the renderer. **/
+#define MAJORANT_CELL 8
+
+/** @struct Volume
+  * @brief Density grid parameters.
+**/
+typedef struct Volume
+{
+    /** The grid's lower bound, in world space. **/
+    float4 lower;
+    /** The grid's upper bound, in world space. **/
+    float4 upper;
+    /** The number of voxels along each axis, and the offset of the first. **/
+    uint4 size;
+    /** The number of majorant cells along each axis, and the offset of the
+      * first (the last cells may extend past the grid's bounds).
+    **/
+    uint4 coarse;
+} Volume;
+
+/** @struct MajorantWalk
+  * @brief State of a ray's traversal of a grid's majorant cells.
+**/
+typedef struct MajorantWalk
+{
+    /** The distances along the ray to the next cell along each axis. **/
+    float3 next;
+    /** The distances along the ray across a cell along each axis. **/
+    float3 delta;
+    /** The cell the ray is in. **/
+    int3 cell;
+    /** The direction of the ray along each axis. **/
+    int3 step;
+    /** The distance along the ray at which the cell is entered. **/
+    float t;
+    /** The distance along the ray at which the traversal ends. **/
+    float end;
+} MajorantWalk;
+
+/** Returns whether a medium has a density grid.
+  * @param material The medium's material.
+  * @returns Whether it must be tracked through, rather than sampled directly.
+**/
+bool heterogeneous(constant Material *material)
+{
+    return SCENE_VOLUMES && (material->volume != 0);
+}
+
+/** Returns the density of a grid at some point, that of the nearest voxel.
+  * @param p The point, in world space.
+  * @param volume The grid.
+  * @param grids The densities and majorants of all grids.
+  * @returns The density, which is zero outside of the grid.
+**/
+float VolumeDensity(float3 p, constant Volume *volume, global float *grids)
+{
+    float3 u = (p - volume->lower.xyz)
+             / (volume->upper.xyz - volume->lower.xyz);
+    if (any(u < 0.0f) || any(u >= 1.0f)) return 0.0f;
+
+    uint3 size = volume->size.xyz;
+    uint3 v = min(convert_uint3(u * convert_float3(size)), size - 1);
+    return grids[volume->size.w + (v.z * size.y + v.y) * size.x + v.x];
+}
+
+/** Starts the traversal of a grid's majorant cells along a ray segment.
+  * @param walk The traversal state.
+  * @param origin The ray's origin.
+  * @param direction The ray's direction.
+  * @param distance The length of the segment.
+  * @param volume The grid.
+  * @returns Whether the segment goes through the grid at all.
+**/
+bool StartWalk(MajorantWalk *walk, float3 origin, float3 direction,
+               float distance, constant Volume *volume)
+{
+    float3 lower = volume->lower.xyz, upper = volume->upper.xyz;
+
+    /* Clip the segment against the grid's bounds. */
+    float3 t0 = (lower - origin) / direction;
+    float3 t1 = (upper - origin) / direction;
+    float3 tn = fmin(t0, t1), tf = fmax(t0, t1);
+
+    walk->t = max(max(tn.x, tn.y), max(tn.z, 0.0f));
+    walk->end = min(min(tf.x, tf.y), min(tf.z, distance));
+    if (walk->t >= walk->end) return false;
+
+    /* Find the cell in which the segment starts. */
+    int3 coarse = convert_int3(volume->coarse.xyz);
+    float3 cellSize = (upper - lower) * MAJORANT_CELL
+                    / convert_float3(volume->size.xyz);
+    float3 g = (origin + walk->t * direction - lower) / cellSize;
+    walk->cell = clamp(convert_int3(g), (int3)(0), coarse - 1);
+
+    /* Find where the ray crosses into the next cell along each axis. */
+    int3 ahead = (direction > 0.0f) ? (int3)(1) : (int3)(0);
+    float3 bound = lower + convert_float3(walk->cell + ahead) * cellSize;
+
+    walk->step = (direction > 0.0f) ? (int3)(1) : (int3)(-1);
+    walk->next = (direction != 0.0f) ? (bound - origin) / direction
+                                     : (float3)(INFINITY);
+    walk->delta = (direction != 0.0f) ? cellSize / fabs(direction)
+                                      : (float3)(INFINITY);
+    return true;
+}
+
+/** Moves on to the next majorant cell of a traversal.
+  * @param walk The traversal state.
+  * @param volume The grid.
+  * @param grids The densities and majorants of all grids.
+  * @param t0 A pointer in which to store where the ray enters the cell.
+  * @param t1 A pointer in which to store where the ray leaves the cell.
+  * @param majorant A pointer in which to store the cell's majorant.
+  * @returns Whether there was a cell left, if not, nothing is stored.
+**/
+bool NextCell(MajorantWalk *walk, constant Volume *volume, global float *grids,
+              float *t0, float *t1, float *majorant)
+{
+    if (walk->t >= walk->end) return false;
+
+    int3 coarse = convert_int3(volume->coarse.xyz);
+    *majorant = grids[volume->coarse.w + (walk->cell.z * coarse.y
+                                        + walk->cell.y) * coarse.x
+                                        + walk->cell.x];
+
+    float exit = min(min(walk->next.x, walk->next.y), walk->next.z);
+    *t0 = walk->t;
+    *t1 = walk->t = min(exit, walk->end);
+
+    /* Step into the cell beyond the nearest boundary. */
+    if (exit == walk->next.x)
+    {
+        walk->cell.x += walk->step.x;
+        walk->next.x += walk->delta.x;
+    }
+    else if (exit == walk->next.y)
+    {
+        walk->cell.y += walk->step.y;
+        walk->next.y += walk->delta.y;
+    }
+    else
+    {
+        walk->cell.z += walk->step.z;
+        walk->next.z += walk->delta.z;
+    }
+
+    /* The traversal is over once the ray leaves the grid. */
+    if (any(walk->cell < 0) || any(walk->cell >= coarse))
+        walk->end = walk->t;
+
+    return true;
+}
+
+/** Samples the distance to the next collision with a heterogeneous medium,
+  * by delta tracking. Tentative collisions are sampled against the majorant
+  * of each cell (over all wavelengths), and are real with a probability which
+  * is the average of the medium's coefficients over the majorant, so each
+  * wavelength is weighted by its own coefficient over that probability.
+  * @param material The medium's material, which must be heterogeneous.
+  * @param w The light path's wavelengths, in meters.
+  * @param origin The ray's origin.
+  * @param direction The ray's direction.
+  * @param distance The distance to the next surface along the ray.
+  * @param prng A PRNG instance.
+  * @param volumes The density grid table.
+  * @param grids The densities and majorants of all grids.
+  * @param throughput A pointer to the light path's throughput, to weight.
+  * @returns The distance to the collision, or infinity if there is none
+  *          before the surface.
+**/
+float DeltaTrack(constant Material *material, float4 w, float3 origin,
+                 float3 direction, float distance, PRNG *prng,
+                 constant Volume *volumes, global float *grids,
+                 float4 *throughput)
+{
+    constant Volume *volume = volumes + material->volume;
+    float4 ke = absorption(material, w);
+    float kmax = max(max(ke.x, ke.y), max(ke.z, ke.w));
+
+    MajorantWalk walk;
+    if (!StartWalk(&walk, origin, direction, distance, volume))
+        return INFINITY;
+
+    float t0, t1, majorant;
+    while (NextCell(&walk, volume, grids, &t0, &t1, &majorant))
+    {
+        /* Empty cells are skipped without sampling anything. */
+        float mu = majorant * kmax;
+        if (mu == 0.0f) continue;
+
+        for (float t = t0;;)
+        {
+            t -= log(1.0f - rand(prng)) / mu;
+            if (t >= t1) break;
+
+            float4 ks = VolumeDensity(origin + t * direction,
+                                      volume, grids) * ke;
+            float mean = dot(ks, (float4)(0.25f));
+
+            if (rand(prng) * mu < mean)
+            {
+                *throughput *= ks / mean;
+                return t;
+            }
+
+            *throughput *= (mu - ks) / (mu - mean);
+        }
+    }
+
+    return INFINITY;
+}
+
+/** Estimates the transmittance of a medium along a ray segment, exactly if it
+  * is homogeneous, and otherwise by ratio tracking, against the majorant of
+  * each cell, which gives an unbiased estimate in [0..1] at each wavelength.
+  * @param material The medium's material.
+  * @param w The light path's wavelengths, in meters.
+  * @param origin The ray's origin.
+  * @param direction The ray's direction.
+  * @param distance The length of the segment.
+  * @param prng A PRNG instance.
+  * @param volumes The density grid table.
+  * @param grids The densities and majorants of all grids.
+  * @returns The transmittance, at each wavelength.
+**/
+float4 Transmittance(constant Material *material, float4 w, float3 origin,
+                     float3 direction, float distance, PRNG *prng,
+                     constant Volume *volumes, global float *grids)
+{
+    float4 ke = absorption(material, w);
+    if (!heterogeneous(material)) return exp(-ke * distance);
+
+    constant Volume *volume = volumes + material->volume;
+    float kmax = max(max(ke.x, ke.y), max(ke.z, ke.w));
+    float4 transmittance = (float4)(1.0f);
+
+    MajorantWalk walk;
+    if (!StartWalk(&walk, origin, direction, distance, volume))
+        return transmittance;
+
+    float t0, t1, majorant;
+    while (NextCell(&walk, volume, grids, &t0, &t1, &majorant))
+    {
+        float mu = majorant * kmax;
+        if (mu == 0.0f) continue;
+
+        for (float t = t0;;)
+        {
+            t -= log(1.0f - rand(prng)) / mu;
+            if (t >= t1) break;
+
+            transmittance *= 1.0f - VolumeDensity(origin + t * direction,
+                                                  volume, grids) * ke / mu;
+        }
+
+        if (all(transmittance == (float4)(0.0f))) break;
+    }
+
+    return transmittance;
+}
@@ -44,6 +44,8 @@ namespace Error
     extern const std::string Execute;
     /** @brief The CLC build log could not be retrieved. **/
     extern const std::string BuildLog;
+    /** @brief A material definition is invalid (e.g. unknown model). **/
+    extern const std::string Material;
 
     /** @brief Throws a formatted exception based on an error code.
       * @param msg The message to use, such as Error::Memory.
@@ -67,17 +69,22 @@ void QueryDevices(cl::Platform& platform, std::vector<cl::Device>& devices);
 void PlatformName(cl::Platform& platform, std::string& name);
 void DeviceName(cl::Device& device, std::string& name);
 cl::Context CreateContext(std::vector<cl::Device>& devices);
-cl::CommandQueue CreateQueue(cl::Context& context, cl::Device& device);
+cl::CommandQueue CreateQueue(cl::Context& context, cl::Device& device,
+                             cl_command_queue_properties properties = 0);
 cl::Program CreateProgram(cl::Context& context, cl::Program::Sources& code);
 cl::Kernel CreateKernel(cl::Program& program, const char* name);
 std::string GetBuildLog(cl::Program& program, cl::Device& device);
 size_t GetWorkGroupSize(cl::Kernel& kernel, cl::Device& device);
+size_t GetComputeUnits(cl::Device& device);
 void ExecuteKernel(cl::CommandQueue& queue, cl::Kernel& kernel,
-                   cl::NDRange offset, cl::NDRange global, cl::NDRange local);
+                   cl::NDRange offset, cl::NDRange global, cl::NDRange local,
+                   cl::Event* event = nullptr);
+void Flush(cl::CommandQueue& queue);
 void FlushAndWait(cl::CommandQueue& queue);
+void WaitForEvent(cl::Event& event);
 
 template <typename T>
-void BindArgument(cl::Kernel& kernel, T& buffer, cl_uint index)
+void BindArgument(cl::Kernel& kernel, const T& buffer, cl_uint index)
 {
     Error::Check(Error::Bind, kernel.setArg(index, buffer));   
 }
@@ -88,7 +95,7 @@ void WriteToBuffer(cl::CommandQueue& queue, cl::Buffer& buffer, cl_bool block,
                    size_t offset, size_t size, const void* ptr);
 void ReadFromBuffer(cl::CommandQueue& queue, const cl::Buffer& buffer,
                     cl_bool block, size_t offset, size_t size,
-                    void* ptr);
+                    void* ptr, cl::Event* event = nullptr);
 cl::Image2D CreateImage2D(cl::Context& context, cl_mem_flags flags,
                           cl::ImageFormat format, size_t width, size_t height,
                           void* hostptr = nullptr);
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/** @file options.hpp
+  * @brief Engine options.
+**/
+
+/** @struct EngineOptions
+  * @brief Advanced engine options.
+  *
+  * These options are not prompted for by the interface, they are only read
+  * from the \c Engine node of the epsilon.xml configuration file, if it is
+  * present. The default values reproduce the engine's standard behaviour.
+  * Most of them are forwarded to the kernel as preprocessor definitions.
+**/
+struct EngineOptions
+{
+    /** @brief Whether surface interactions are binned by material ID before
+      *        being shaded, see \c KERNEL_MODE_SORTED in epsilon.cl.
+    **/
+    bool sortShading;
+
+    /** @brief Whether to use persistent work-items which fetch pixels from a
+      *        global counter, see \c KERNEL_MODE_PERSISTENT in epsilon.cl.
+    **/
+    bool persistent;
+
+    /** @brief The number of samples per pixel rendered by each kernel launch,
+      *        the render passes are then spread over fewer launches.
+    **/
+    size_t samplesPerLaunch;
+
+    /** @brief Whether the kernel is launched over a 2D range of pixels, see
+      *        \c KERNEL_MODE_2D in epsilon.cl (ignored in persistent mode).
+    **/
+    bool dispatch2D;
+
+    /** @brief The maximum number of kernel launches enqueued ahead of the
+      *        device, so that it never has to wait for the host.
+    **/
+    size_t launchesInFlight;
+
+    /** @brief The side of the square pixel tiles traversed in Morton order
+      *        by the kernel, a power of two, or zero for row-major order.
+    **/
+    size_t tileSize;
+
+    /** @brief Whether rays are sorted by direction and origin before being
+      *        traced, see \c KERNEL_MODE_RAYSORT in epsilon.cl.
+    **/
+    bool sortRays;
+
+    /** @brief Whether the kernel is specialized for the scene, by baking the
+      *        scene's constants into it, see \c KernelObject::Specialize.
+    **/
+    bool specialize;
+
+    /** @brief The directory in which compiled kernels are cached, see \c
+      *        ProgramCache. If empty, kernels are always built from source.
+    **/
+    std::string cacheDir;
+
+    /** @brief Whether to autotune the work group size, if it isn't already
+      *        in the profile (in \c cacheDir), see \c Autotuner.
+    **/
+    bool autotune;
+
+    /** @brief The sampler used by the kernel, either "random" (independent
+      *        pseudorandom numbers), "philox" (the same, from a cheaper 32-bit
+      *        generator, see \c SAMPLER_PHILOX in prng.cl) or "sobol", see
+      *        \c SAMPLER_SOBOL in prng.cl. Any other value selects "random".
+    **/
+    std::string sampler;
+
+    /** @brief Whether the Sobol sampler distributes its error across pixels
+      *        as blue noise, see \c SAMPLER_BLUE_NOISE in prng.cl.
+    **/
+    bool blueNoise;
+
+    /** @brief Whether to benchmark every sampler on the device before the
+      *        render, see \c BenchmarkSamplers.
+    **/
+    bool benchmarkSamplers;
+
+    /** @brief Whether light sources are sampled explicitly from diffuse
+      *        surfaces, see \c KERNEL_MODE_NEE in epsilon.cl.
+    **/
+    bool nextEvent;
+
+    /** @brief Whether light sources are sampled through the light tree, see
+      *        \c KERNEL_MODE_LIGHTTREE in epsilon.cl.
+    **/
+    bool lightTree;
+
+    /** @brief The number of kernel launches between updates of the pixels
+      *        still to be rendered, see \c KERNEL_MODE_ADAPTIVE in epsilon.cl,
+      *        or zero to render every pixel at every launch.
+    **/
+    size_t adaptiveInterval;
+
+    /** @brief The relative error (standard error of the mean luminance over
+      *        the mean luminance) below which a pixel has converged.
+    **/
+    float adaptiveThreshold;
+
+    /** @brief The number of samples a pixel needs before it may converge, it
+      *        is at least twice the number of samples between updates.
+    **/
+    size_t adaptiveMinSamples;
+
+    /** @brief The light transport algorithm, either "path" (unidirectional
+      *        path tracing, see \c clmain in epsilon.cl), "bdpt" (see \c
+      *        KERNEL_MODE_BDPT in epsilon.cl) or "sppm" (see \c
+      *        KERNEL_MODE_SPPM in epsilon.cl). Any other value selects "path".
+    **/
+    std::string integrator;
+
+    /** @brief The number of photons traced at each SPPM iteration, or zero
+      *        for as many as there are pixels.
+    **/
+    size_t photonCount;
+
+    /** @brief The initial SPPM gathering radius, as a fraction of the size
+      *        (bounding box diagonal) of the scene.
+    **/
+    float photonRadius;
+
+    /** @brief The number of bounces after which light paths may be terminated
+      *        by Russian roulette, see \c RR_DEPTH in epsilon.cl.
+    **/
+    size_t rouletteDepth;
+
+    /** @brief The largest number of branches light paths may split into at
+      *        their first diffuse vertex, see \c KERNEL_MODE_SPLIT in
+      *        epsilon.cl, or one to never split them.
+    **/
+    size_t maxSplit;
+
+    /** @brief How the pixel buffer accumulates samples on the device, either
+      *        "float" (sums, as floats) or "half" (means, as halves, see \c
+      *        KERNEL_MODE_HALF in epsilon.cl). Any other value selects "float".
+    **/
+    std::string accumulation;
+
+    /** @brief The number of kernel launches between each time the samples in
+      *        the "half" pixel buffer are added to the host's float buffer.
+    **/
+    size_t flushInterval;
+
+    /** @brief Initializes all options to their default values. **/
+    EngineOptions() : sortShading(false), persistent(false),
+                      samplesPerLaunch(1), dispatch2D(false),
+                      launchesInFlight(2), tileSize(0), sortRays(false),
+                      specialize(true), cacheDir("cache"), autotune(false),
+                      sampler("random"), blueNoise(false),
+                      benchmarkSamplers(false), nextEvent(true),
+                      lightTree(true), adaptiveInterval(0),
+                      adaptiveThreshold(0.02f), adaptiveMinSamples(0),
+                      integrator("path"),
+                      photonCount(0), photonRadius(0.005f), rouletteDepth(3),
+                      maxSplit(1), accumulation("float"), flushInterval(16) { }
+};
@@ -34,4 +34,10 @@ namespace Query
               seconds elapsed since the renderer started working.
     **/
     extern const size_t ElapsedTime;
+
+    /** @brief Queries the number of pixels still to be rendered.
+      * @note \c Query will return a \c cl_uint, only if adaptive sampling is
+      *       enabled (see \c EngineOptions::adaptiveInterval).
+    **/
+    extern const size_t ActivePixels;
 }
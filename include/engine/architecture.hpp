@@ -1,5 +1,6 @@
 #pragma once
 
+#include <common/options.hpp>
 #include <common/error.hpp>
 #include <common/query.hpp>
 
@@ -15,6 +16,14 @@
   * kernel-side code modifications.
 **/
 
+/** @brief Rounds \c x up to the next multiple of \c m, e.g. to pad a global
+  *        work size to a whole number of work groups.
+**/
+inline size_t RoundUp(size_t x, size_t m)
+{
+    return ((x + m - 1) / m) * m;
+}
+
 /** @struct EngineParams
   * @brief General engine parameters.
   *
@@ -45,6 +54,40 @@ struct EngineParams
     size_t height;
     /** @brief The number of render passes (per pixel). **/
     size_t passes;
+    /** @brief Advanced engine options, see \c EngineOptions. **/
+    EngineOptions options;
+    /** @brief The event of the most recently enqueued kernel launch, which
+      *        kernel objects may attach completion callbacks to.
+    **/
+    cl::Event launch;
+
+    /** @brief Returns the number of kernel launches needed for all passes,
+      *        as each launch renders \c options.samplesPerLaunch passes.
+    **/
+    size_t Launches() const
+    {
+        size_t perLaunch = options.samplesPerLaunch;
+        return (passes + perLaunch - 1) / perLaunch;
+    }
+
+    /** @brief Returns the number of pixel indices the kernel must go through,
+      *        which includes the padding of partial tiles.
+    **/
+    size_t PixelSlots() const
+    {
+        size_t tile = options.tileSize;
+        if (tile == 0) return width * height;
+
+        /* Whole tiles, the kernel skips the pixels outside of the render. */
+        return RoundUp(width, tile) * RoundUp(height, tile);
+    }
+
+    /** @brief Returns the number of photons traced at each SPPM iteration.
+    **/
+    size_t Photons() const
+    {
+        return options.photonCount ? options.photonCount : width * height;
+    }
 };
 
 /** @class KernelObject
@@ -114,9 +157,13 @@ class KernelObject
         virtual void Bind(cl_uint* index) = 0;
 
         /** @brief Updates the kernel object.
-          * @param pass This indicates the pass the renderer has just finished.
-          *             Note this is zero-based, first pass is denoted zero.
-          * @note In total, this method will be called \c params.passes times.
+          * @param pass This indicates the launch the renderer has just enqueued
+          *             (zero-based), each launch rendering up to \c
+          *             params.options.samplesPerLaunch passes.
+          * @note In total, this method will be called \c params.Launches()
+          *       times. The launch may not have completed yet, as several of
+          *       them can be in flight (see \c EngineParams::launch), so all
+          *       device transfers must be non-blocking and enqueued in order.
         **/
         virtual void Update(size_t pass) = 0;
 
@@ -131,6 +178,18 @@ class KernelObject
         **/
         virtual void* Query(size_t query) = 0;
 
+        /** @brief Specializes the kernel for the kernel object's data.
+          * @param prelude OpenCL source code prepended to the kernel before it
+          *                is built, in which the kernel object may define
+          *                compile-time constants (see \c SCENE_* in the
+          *                kernel source), to which it should append.
+          * @note This is called before \c Bind, and only if the kernel is to
+          *       be specialized (see \c EngineOptions::specialize). The
+          *       kernel object must still bind all of its arguments. By
+          *       default, this does nothing.
+        **/
+        virtual void Specialize(std::ostream& /* prelude */) { }
+
         /** @brief Destroys the kernel object and frees all resources.
         **/
         virtual ~KernelObject() { }
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <common/error.hpp>
+
+#include <CL/cl.hpp>
+#include <string>
+#include <vector>
+
+/** @file autotune.hpp
+  * @brief Work group size autotuning.
+**/
+
+/** @struct WorkSize
+  * @brief Kernel work group size.
+**/
+struct WorkSize
+{
+    /** @brief The work group's width. **/
+    size_t x;
+    /** @brief The work group's height, this is 1 for 1D launches. **/
+    size_t y;
+
+    WorkSize(size_t x = 1, size_t y = 1) : x(x), y(y) { }
+};
+
+/** @class Autotuner
+  * @brief Work group size autotuner.
+  *
+  * The largest work group size a kernel supports is rarely the fastest one,
+  * so this times the first few launches of a render, each with a different
+  * candidate work group size (and shape, for 2D launches), and then uses the
+  * fastest for the remaining launches. As every candidate launch is a real
+  * pass, the autotuning costs nothing beyond the slower candidates. The first
+  * launch isn't timed, as it also pays for warming up the device, and the
+  * candidates are compared by time per sample, as launches may render fewer
+  * pixels (with adaptive sampling) or samples (the last one) than others.
+  *
+  * The best work group size is saved in a profile file, for each device and
+  * kernel (identified by their \c ProgramCache key), and is loaded on later
+  * runs, whether autotuning is enabled or not. If a render ends before every
+  * candidate was timed, those that were are saved instead, and the next run
+  * with autotuning enabled only times the others. The command queue must have
+  * profiling enabled while autotuning.
+**/
+class Autotuner
+{
+    private:
+        /** @brief The profile's directory. **/
+        std::string directory;
+        /** @brief The profile file, or empty if the profile isn't saved. **/
+        std::string file;
+        /** @brief The key identifying the device and kernel in the profile. **/
+        std::string key;
+        /** @brief The candidate work group sizes. **/
+        std::vector<WorkSize> candidates;
+        /** @brief The time per sample of each candidate, in nanoseconds, or
+          *        a negative value if it hasn't been timed yet.
+        **/
+        std::vector<double> times;
+        /** @brief The candidates still to be timed, one per launch. **/
+        std::vector<size_t> pending;
+        /** @brief The events of the candidate launches, in order. **/
+        std::vector<cl::Event> events;
+        /** @brief The number of samples of each candidate launch. **/
+        std::vector<size_t> samples;
+        /** @brief The work group size to use once tuning is complete. **/
+        WorkSize best;
+        /** @brief Whether the work group size has been chosen. **/
+        bool tuned;
+
+        /** @brief Times the candidate launches recorded so far. **/
+        void Measure();
+
+        /** @brief Picks the fastest candidate, if all have been timed, and
+          *        saves the timings in the profile either way.
+        **/
+        void Finish();
+
+        /** @brief Saves the best work group size in the profile, or the
+          *        timings so far, if some candidates haven't been timed.
+        **/
+        void Save();
+
+    public:
+        /** @brief Prepares the autotuner.
+          * @param directory The profile's directory, if empty, the profile is
+          *                  neither loaded nor saved.
+          * @param key The key of the device and kernel.
+          * @param maximum The largest work group size the kernel supports.
+          * @param dispatch2D Whether the kernel is launched over a 2D range.
+          * @param enabled Whether to autotune, if no profile entry exists.
+        **/
+        Autotuner(std::string directory, std::string key, size_t maximum,
+                  bool dispatch2D, bool enabled);
+
+        /** @brief Returns the work group size to use for a given launch.
+          * @param launch The launch index, zero-based, each launch must be
+          *               recorded with \c Record after being enqueued.
+        **/
+        WorkSize Select(size_t launch);
+
+        /** @brief Records a launch, to be timed if it is a candidate.
+          * @param launch The launch index, zero-based.
+          * @param event The launch's event.
+          * @param samples The number of samples (pixels times passes) the
+          *                launch renders.
+        **/
+        void Record(size_t launch, cl::Event& event, size_t samples);
+
+        /** @brief Stops tuning at the end of a render, saving the timings so
+          *        far if it isn't complete, once every launch has completed.
+        **/
+        void Stop();
+};
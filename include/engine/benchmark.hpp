@@ -0,0 +1,18 @@
+#pragma once
+
+#include <common/error.hpp>
+
+#include <CL/cl.hpp>
+
+/** @file benchmark.hpp
+  * @brief Sampler microbenchmark.
+**/
+
+/** Measures the throughput of each of the kernel's samplers on a device, in
+  * random numbers per second, by timing the microbenchmark kernel in bench.cl
+  * built for each of them, and logs the results. This is only meant to help
+  * choose the \c Sampler engine option, as it doesn't measure sample quality.
+  * @param context The OpenCL context.
+  * @param device The device to benchmark.
+**/
+void BenchmarkSamplers(cl::Context& context, cl::Device& device);
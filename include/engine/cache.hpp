@@ -0,0 +1,79 @@
+#pragma once
+
+#include <common/error.hpp>
+
+#include <CL/cl.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** @file cache.hpp
+  * @brief Kernel binary cache.
+**/
+
+/** @class ProgramCache
+  * @brief On-disk cache of compiled programs.
+  *
+  * Building the kernel from source can take several seconds on some OpenCL
+  * runtimes, so the compiled program binary is saved after a successful build
+  * and loaded back on subsequent runs. Each binary is stored in its own file,
+  * named after a hash of everything which could affect it:
+  * - the device name and driver version,
+  * - the build options,
+  * - the program source, and all of the files it includes from \c cl/.
+  *
+  * A binary which cannot be loaded or built (e.g. stale or corrupt) is simply
+  * ignored, and the program is then built from source and cached again.
+**/
+class ProgramCache
+{
+    private:
+        /** @brief The cache directory, or empty if the cache is disabled. **/
+        std::string directory;
+        /** @brief The path to the cached binary for this program. **/
+        std::string path;
+        /** @brief The hash identifying this program, in hexadecimal. **/
+        std::string key;
+
+        /** @brief Hashes the contents of an included kernel source file, and
+          *        all of the files it includes in turn (only once each).
+        **/
+        void HashFile(const std::string& name, uint64_t& hash,
+                      std::vector<std::string>& visited);
+
+    public:
+        /** @brief Prepares the cache entry for a given program.
+          * @param directory The cache directory, if empty, nothing is cached.
+          * @param device The device the program is built for.
+          * @param source The program source.
+          * @param options The program build options.
+        **/
+        ProgramCache(std::string directory, cl::Device& device,
+                     const std::string& source, const std::string& options);
+
+        /** @brief Attempts to load the program from the cache, and to build it.
+          * @param context The context to create the program in.
+          * @param devices The devices to build the program for.
+          * @param options The program build options.
+          * @param program The program, which is only modified on success.
+          * @returns Whether the cached program was successfully built.
+        **/
+        bool Load(cl::Context& context, std::vector<cl::Device>& devices,
+                  const std::string& options, cl::Program& program);
+
+        /** @brief Saves a built program's binary into the cache.
+          * @param program The program, already built for a single device.
+          * @note Failing to save the binary is not an error, it is logged.
+        **/
+        void Store(cl::Program& program);
+
+        /** @brief Returns a key identifying the program and the device it is
+          *        built for, which is computed even if caching is disabled.
+        **/
+        const std::string& Key() const { return key; }
+};
+
+/** @brief Creates a directory, does nothing if it already exists.
+  * @param path The directory's path.
+**/
+void MakeDirectory(const std::string& path);
@@ -1,14 +1,21 @@
 #pragma once
 
 #include <engine/architecture.hpp>
+#include <engine/autotune.hpp>
+#include <engine/benchmark.hpp>
+#include <engine/cache.hpp>
 
 #include <math/prng.hpp>
 #include <render/render.hpp>
+#include <render/sky.hpp>
+#include <render/photonmap.hpp>
 #include <misc/misc.hpp>
 #include <math/camera.hpp>
 #include <geometry/geometry.hpp>
 #include <material/material.hpp>
 
+#include <deque>
+
 /** @file renderer.hpp
   * @brief ɛpsilon rendering engine.
   *
@@ -35,8 +42,29 @@ class Renderer
         std::vector<KernelObject*> objects;
         /** @brief The engine parameters. **/
         EngineParams params;
-        /** @brief The current render pass. **/
+        /** @brief The current render pass (kernel launch). **/
         size_t currentPass;
+        /** @brief Events of the kernel launches which may still be running. **/
+        std::deque<cl::Event> inFlight;
+        /** @brief The work group size autotuner. **/
+        Autotuner* tuner;
+        /** @brief The number of samples dispatched so far. **/
+        double samples;
+
+        /** @brief Returns the kernel build options, which include the kernel
+          *        mode definitions selected by the engine options.
+        **/
+        std::string BuildOptions();
+
+        /** @brief Returns the source code to prepend to the kernel, which
+          *        specializes it for the scene, see \c Specialize.
+        **/
+        std::string Prelude();
+
+        /** @brief Waits for the device to catch up after the last launch, and
+          *        reports the throughput over the samples actually rendered.
+        **/
+        void Finish();
 
     public:
         /** @brief Initializes the renderer.
@@ -47,18 +75,22 @@ class Renderer
           * @param device The OpenCL device to use for rendering.
           * @param source The engine source (scene directory).
           * @param output The engine output (PPM image file).
+          * @param options Advanced engine options.
         **/
         Renderer(size_t width, size_t height, size_t passes,
                 cl::Platform platform, cl::Device device,
-                std::string source, std::string output);
+                std::string source, std::string output,
+                EngineOptions options);
 
         /** @brief Frees the renderer and all associated resources.
         **/
         ~Renderer();
 
-        /** @brief Instructs the renderer to perform one pass.
+        /** @brief Instructs the renderer to enqueue one pass, this will only
+          *        block if too many passes are already in flight.
           * @returns Returns \c true if this was the final pass, and
-          *          \c false otherwise.
+          *          \c false otherwise (all passes are complete once \c true
+          *          has been returned).
         **/  
         bool Execute();
 
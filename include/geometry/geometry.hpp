@@ -11,7 +11,10 @@
 /** @class Geometry
   * @brief Scene-wide geometry.
   *
-  * This kernel object manages the list of triangles in the scene to render.
+  * This kernel object manages the list of triangles in the scene to render,
+  * and the light list, which holds the triangles whose material emits light
+  * (see \c Materials::Emitters), for the kernel to sample them explicitly,
+  * either by area or through a \c LightTree built over them.
   * 
   * This kernel object handles the following queries:
   * - \c Query::TriangleCount
@@ -31,6 +34,18 @@ class Geometry : public KernelObject
         /** @brief Contains the BVH nodes (for traversal). **/
         cl::Buffer nodes;
 
+        /** @brief Contains the light list, with the area distribution. **/
+        cl::Buffer lights;
+
+        /** @brief Contains the light tree's nodes, see \c LightTree. **/
+        cl::Buffer lightTree;
+
+        /** @brief Contains the number of entries in the light list. **/
+        cl_uint lightCount;
+
+        /** @brief Contains the total area of the light sources. **/
+        cl_float lightArea;
+
     public:
         Geometry(EngineParams& params);
         ~Geometry();
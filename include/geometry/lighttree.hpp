@@ -0,0 +1,89 @@
+#pragma once
+
+#include <math/aabb.hpp>
+
+#include <CL/cl.hpp>
+#include <cstdint>
+#include <vector>
+
+/** @file lighttree.hpp
+  * @brief Light source hierarchy.
+**/
+
+/** @struct Emitter
+  * @brief An emissive triangle, as seen by the light tree.
+**/
+struct Emitter
+{
+    /** @brief The triangle's bounding box. **/
+    AABB bounds;
+    /** @brief The triangle's unit normal (it emits on both sides). **/
+    Vector normal;
+    /** @brief The triangle's emitted power. **/
+    float power;
+    /** @brief The triangle's index in the triangle list. **/
+    uint32_t triangle;
+    /** @brief The path from the root of the tree to the emitter's leaf, one
+      *        bit per level from the least significant, set when the path
+      *        goes to the right child. This is filled in by the tree.
+    **/
+    uint32_t trail;
+};
+
+/** @struct cl_light_node
+  * @brief Device-side light tree node.
+**/
+struct cl_light_node
+{
+    cl_float4 min;  /* Bounding box, the w-component is the total power.  */
+    cl_float4 max;  /* Bounding box, the w-component is the cone's angle. */
+    cl_float4 axis; /* The normal cone's axis (in either direction).      */
+    cl_uint4 data;  /* Right child (zero for leaves), and leaf triangle.   */
+};
+
+/** @class LightTree
+  * @brief Bounding volume hierarchy over the light sources.
+  *
+  * With many light sources, most of them contribute little to any given point,
+  * so sampling them by area wastes most samples. This builds a binary tree over
+  * the emissive triangles, of which each node bounds its emitters' positions
+  * and normals (as a cone, which is two-sided like the emitters), along with
+  * their total power. The kernel then descends it from the root, choosing each
+  * child with probability proportional to its estimated contribution to the
+  * point being shaded, which is cheap to compute from those bounds.
+  *
+  * The nodes are in depth-first order, each left child following its parent.
+**/
+class LightTree
+{
+    private:
+        /** @brief The tree's nodes. **/
+        std::vector<cl_light_node> nodes;
+
+        /** @brief Builds the subtree over a range of emitters.
+          * @param emitters The emitters, which will be reordered.
+          * @param start The first emitter of the range.
+          * @param end One past the last emitter of the range.
+          * @param trail The path from the root to the subtree's root.
+          * @param depth The depth of the subtree's root.
+        **/
+        void Build(std::vector<Emitter>& emitters, size_t start, size_t end,
+                   uint32_t trail, uint32_t depth);
+
+    public:
+        /** @brief Builds the tree over a list of emitters.
+          * @param emitters The emitters, which will be reordered, and of which
+          *                 the \c trail will be set.
+        **/
+        LightTree(std::vector<Emitter>& emitters);
+
+        /** @brief Returns the tree's nodes, for upload to the device.
+        **/
+        const std::vector<cl_light_node>& Nodes() { return nodes; }
+
+        /** @brief Returns the power emitted by a black body, per unit area,
+          *        over the visible spectrum.
+          * @param temperature The black body's temperature, in kelvins.
+        **/
+        static float VisiblePower(float temperature);
+};
@@ -6,6 +6,7 @@
 #include <ncurses.h>
 #endif
 
+#include <common/options.hpp>
 #include <common/version.hpp>
 
 #include <CL/cl.hpp>
@@ -89,6 +90,8 @@ class Interface
         size_t height;
         /** @brief Number of render passes. **/
         size_t passes;
+        /** @brief Advanced engine options (configuration file only). **/
+        EngineOptions options;
 
         /** @brief Constructs the interface and sets it up. **/
         Interface();
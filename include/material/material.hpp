@@ -1,6 +1,11 @@
 #pragma once
 
 #include <engine/architecture.hpp>
+#include <misc/pugixml.hpp>
+
+#include <map>
+#include <set>
+#include <string>
 
 /** @file material.hpp
   * @brief Material handling.
@@ -9,9 +14,25 @@
 /** @class Materials
   * @brief Device-side materials.
   *
-  * This kernel object is responsible for mapping material ID's to device-side
+  * This kernel object is responsible for mapping models to device-side
   * materials, via a mapping function. This is used to decouple geometry and
-  * material system.
+  * material system. It also uploads the material table, which contains the
+  * built-in materials (see material.cl) followed by those defined in the
+  * scene's materials.xml, each as a model type with its parameters:
+  *
+  * \code
+  * <model ModelID="wall" Model="matte" Albedo="0.8" />
+  * <model ModelID="lamp" Model="light" Temperature="3500" />
+  * <model ModelID="cube" Model="glass" Loss="0.9" Index="1.55"
+  *        Absorption="1.2" Tint="650" />
+  * \endcode
+  *
+  * Media absorb all wavelengths but those around their \c Tint (in nm, which
+  * is red by default), or all of them evenly if it is zero.
+  *
+  * Nodes with a \c MatID attribute instead refer to a built-in material. The
+  * medium inside of a material may also have a density grid (see \c Volumes),
+  * which the renderer uploads along with the table.
   *
   * This kernel object handles no queries.
 **/
@@ -21,10 +42,36 @@ class Materials : public KernelObject
         /** @brief This is the material mapping. **/
         cl::Buffer mapping;
 
+        /** @brief This is the material table. **/
+        cl::Buffer materials;
+
+        /** @brief This is the density grid table. **/
+        cl::Buffer volumes;
+
+        /** @brief The densities and majorants of all density grids. **/
+        cl::Buffer grids;
+
+        /** @brief The number of density grids. **/
+        size_t volumeCount;
+
+        /** @brief The material models used by the scene, as a bitmask. **/
+        cl_uint models;
+
+        /** @brief The maximum nesting depth of the scene's media. **/
+        size_t nesting;
+
     public:
         Materials(EngineParams& params);
         ~Materials() { }
 
+        /** @brief Returns the model ID's of the light sources.
+          * @param doc The scene's materials.xml document.
+          * @returns The model ID's mapped to an emissive material, with the
+          *          temperature of their black body emission.
+        **/
+        static std::map<std::string, float> Emitters(pugi::xml_document& doc);
+
+        void Specialize(std::ostream& prelude);
         void Bind(cl_uint* index);
         void Update(size_t index);
         void* Query(size_t query);
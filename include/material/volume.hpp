@@ -0,0 +1,79 @@
+#pragma once
+
+#include <misc/pugixml.hpp>
+
+#include <CL/cl.hpp>
+#include <string>
+#include <vector>
+
+/** @file volume.hpp
+  * @brief Heterogeneous media.
+**/
+
+/** @struct cl_volume
+  * @brief Device-side density grid parameters.
+**/
+struct cl_volume
+{
+    cl_float4 lower;  /* Grid bounds, in world space.                    */
+    cl_float4 upper;  /* The w-components are unused.                    */
+    cl_uint4 size;    /* Voxels along each axis, and offset of the first. */
+    cl_uint4 coarse;  /* Majorant cells along each axis, and the same.    */
+};
+
+/** @class Volumes
+  * @brief Density grids of the scene's media.
+  *
+  * A medium may be given a density grid in materials.xml, which scales its
+  * absorption coefficient at every point within the grid's bounds (it is zero
+  * outside of them), like so:
+  *
+  * \code
+  * <model ModelID="smoke" Model="none" Index="1.0" Absorption="0.5">
+  *     <density Grid="smoke.raw" Width="64" Height="64" Depth="64"
+  *              Scale="1.0">
+  *         <lower x="-1" y="0" z="-1" />
+  *         <upper x="1" y="2" z="1" />
+  *     </density>
+  * </model>
+  * \endcode
+  *
+  * The grid is a raw file in the scene's directory, of 32-bit floats, with x
+  * varying fastest, then y, then z. Each block of voxels is also summarized
+  * by its largest density, a majorant against which the kernel tracks light
+  * through the medium (see volume.cl), so that empty blocks are skipped.
+  *
+  * The first entry of the table is a placeholder, as materials refer to their
+  * grid by index, and zero means that the medium is homogeneous.
+**/
+class Volumes
+{
+    private:
+        /** @brief The density grid table. **/
+        std::vector<cl_volume> table;
+
+        /** @brief The densities and majorants of all grids. **/
+        std::vector<cl_float> grids;
+
+    public:
+        /** @brief Creates a table without any density grids. **/
+        Volumes();
+
+        /** @brief Loads a density grid.
+          * @param node The grid's \c density node.
+          * @param source The scene's directory.
+          * @returns The grid's index in the table, which is nonzero.
+        **/
+        cl_uint Load(pugi::xml_node node, const std::string& source);
+
+        /** @brief Returns the number of density grids. **/
+        size_t Count() { return table.size() - 1; }
+
+        /** @brief Returns the density grid table, for upload to the device.
+        **/
+        const std::vector<cl_volume>& Table() { return table; }
+
+        /** @brief Returns the densities and majorants of all grids.
+        **/
+        const std::vector<cl_float>& Grids() { return grids; }
+};
@@ -19,10 +19,14 @@ class Camera : public KernelObject
     private:
         cl::Buffer buffer;
 
+        /** @brief The camera parameters, as an OpenCL struct initializer. **/
+        std::string initializer;
+
     public:
         Camera(EngineParams& params);
         ~Camera() { }
 
+        void Specialize(std::ostream& prelude);
         void Bind(cl_uint* index);
         void Update(size_t index);
         void* Query(size_t query);
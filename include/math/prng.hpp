@@ -10,8 +10,10 @@
   * @brief Pseudorandom number generator.
   *
   * This is a lightweight, cryptographic-grade pseudorandom number generator,
-  * wrapped up as a kernel object. It uploads a new seed to the device at
-  * every render pass (otherwise each pass would yield the same result).
+  * wrapped up as a kernel object. Before every kernel launch, it sets the range
+  * of samples (per pixel) the launch is to render as kernel arguments, which
+  * needs no device transfer. Each sample of each pixel then has its own
+  * independent stream of pseudorandom numbers.
   *
   * This kernel object handles no queries.
 **/
@@ -23,6 +25,14 @@ class PRNG : public KernelObject
 
         /** @brief This is the device-side buffer containing the seed. **/
         cl::Buffer buffer;
+
+        /** @brief The kernel argument slot of the sample range. **/
+        cl_uint slot;
+
+        /** @brief Sets the sample range kernel arguments for a given launch.
+          * @param launch The launch index, zero-based.
+        **/
+        void SetRange(size_t launch);
     public:
         PRNG(EngineParams& params);
         ~PRNG() { }
@@ -2,6 +2,8 @@
 
 #include <engine/architecture.hpp>
 
+#include <atomic>
+
 /** @file misc.hpp
   * @brief Miscellaneous engine tools.
 **/
@@ -11,7 +13,9 @@
 
   * This kernel object does not actually bind anything to the device but simply
   * provides metrics on the renderer's current progress, and calculates the ETC
-  * (estimated time to completion) of the renderer.
+  * (estimated time to completion) of the renderer. Progress is tracked through
+  * completion callbacks on the kernel launches, since the renderer no longer
+  * waits for each launch to complete before enqueuing the next one.
   *
   * This kernel object handles the following queries:
   * - \c Query::Progress
@@ -30,6 +34,17 @@ class Progress : public KernelObject
         double progress;
         double remains;
 
+        /** @brief The number of launches completed so far by the device. **/
+        std::atomic<size_t> completed;
+
+        /** @brief Launch completion callback, called by the OpenCL runtime.
+        **/
+        static void CL_CALLBACK Completed(cl_event event, cl_int status,
+                                          void* data);
+
+        /** @brief Recomputes the metrics from the completed launches. **/
+        void Refresh();
+
     public:
         Progress(EngineParams& params);
         ~Progress() { }
@@ -38,3 +53,30 @@ class Progress : public KernelObject
         void Update(size_t index);
         void* Query(size_t query);
 };
+
+/** @class WorkQueue
+  * @brief Device-side work counter.
+  *
+  * This kernel object manages the global counter from which the persistent
+  * work-items fetch pixels to render (see \c KERNEL_MODE_PERSISTENT), and
+  * rewinds it after every pass. It is bound even when persistent mode is not
+  * in use, so that the kernel's signature remains the same.
+  *
+  * This kernel object handles no queries.
+**/
+class WorkQueue : public KernelObject
+{
+    private:
+        /** @brief The device-side counter. **/
+        cl::Buffer counter;
+        /** @brief The counter's initial value (source of the rewinds). **/
+        cl_uint zero;
+
+    public:
+        WorkQueue(EngineParams& params);
+        ~WorkQueue() { }
+
+        void Bind(cl_uint* index);
+        void Update(size_t index);
+        void* Query(size_t query);
+};
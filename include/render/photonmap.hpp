@@ -0,0 +1,42 @@
+#pragma once
+
+#include <engine/architecture.hpp>
+
+/** @file photonmap.hpp
+  * @brief Photon mapping.
+**/
+
+/** @class PhotonMap
+  * @brief Stochastic progressive photon mapping state.
+  *
+  * This kernel object is only used in SPPM mode (see the Integrator engine
+  * option), in which it holds the visible point and the photon statistics of
+  * each pixel, and the hash grid through which photons find visible points,
+  * all of which stay on the device. After each launch of the kernel, which
+  * traces the visible points, it launches the kernel twice more, to trace
+  * the photons, then to update the pixels (see sppm.cl). It must be bound
+  * before the PRNG, which sets up the next launch in its own update.
+  *
+  * This kernel object handles no queries.
+**/
+class PhotonMap : public KernelObject
+{
+    private:
+        /** @brief The photon statistics of each pixel. **/
+        cl::Buffer stats;
+        /** @brief The visible point of each pixel. **/
+        cl::Buffer points;
+        /** @brief The hash grid's buckets, and its number of entries. **/
+        cl::Buffer grid;
+        /** @brief The hash grid's entries. **/
+        cl::Buffer entries;
+        /** @brief The kernel argument slot of the iteration stage. **/
+        cl_uint slot;
+    public:
+        PhotonMap(EngineParams& params);
+        ~PhotonMap() { }
+
+        void Bind(cl_uint* index);
+        void Update(size_t index);
+        void* Query(size_t query);
+};
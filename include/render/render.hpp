@@ -19,7 +19,20 @@
   * kernel object is actually responsible for saving the final render to
   * the output file, and does so upon destruction.
   *
-  * This kernel object handles no queries.
+  * With adaptive sampling, it also keeps the second moment of each pixel's
+  * luminance, and every few launches, lists the pixels whose relative error
+  * is still above the threshold, so that only those are rendered next. When
+  * light paths are split, it keeps the statistics from which the kernel picks
+  * each pixel's number of branches (see \c SplitFactor in epsilon.cl).
+  *
+  * With half accumulation, the device's pixel buffer holds halves, which are
+  * added to the host's pixel buffer and reset every few launches, so that the
+  * device needs half the memory, and these readbacks half the bandwidth. The
+  * readbacks are asynchronous, the samples being added on the next one, so
+  * they don't drain the launches in flight.
+  *
+  * This kernel object handles the following queries:
+  * - \c Query::ActivePixels (with adaptive sampling only)
 **/
 class PixelBuffer : public KernelObject
 {
@@ -28,13 +41,47 @@ class PixelBuffer : public KernelObject
         cl::Buffer pb;
         float *pixels;
 
+        /** @brief The second moment of each pixel's luminance. **/
+        cl::Buffer moments;
+        /** @brief The number of pixels still to be rendered, followed by
+          *        their indices (see \c PixelCoords in epsilon.cl).
+        **/
+        cl::Buffer active;
+        /** @brief The kernel which updates the list of active pixels. **/
+        cl::Kernel converge;
+        /** @brief The number of pixels still to be rendered. **/
+        cl_uint activeCount;
+        /** @brief The splitting statistics of each pixel. **/
+        cl::Buffer splitting;
+        /** @brief The host copy of the pixel buffer, with halves, if the
+          *        device accumulates halves (see \c StartFlush).
+        **/
+        std::vector<cl_half> compact;
+        /** @brief The halves the device's pixel buffer is reset to. **/
+        std::vector<cl_half> zeros;
+        /** @brief The event of the last flush's read. **/
+        cl::Event flushed;
+        /** @brief Whether the last flush's samples are still to be added. **/
+        bool flushing;
+
         void Acquire(EngineParams& params);
 
+        /** @brief Enqueues a read of the device's half pixel buffer, and its
+          *        reset, without waiting for either.
+        **/
+        void StartFlush();
+
+        /** @brief Waits for the last flush, if any, and adds its samples to
+          *        the host's float pixel buffer.
+        **/
+        void FinishFlush();
+
         void WriteToFile(std::string path);
     public:
         PixelBuffer(EngineParams& params);
         ~PixelBuffer();
 
+        void Specialize(std::ostream& prelude);
         void Bind(cl_uint* index);
         void Update(size_t index);
         void* Query(size_t query);
@@ -45,14 +92,17 @@ class PixelBuffer : public KernelObject
   * @brief Color-matching curve.
   *
   * This kernel object just uploads a color-matching curve to the device, to
-  * map optical wavelengths to their tristimulus "perceptual" XYZ values.
+  * map optical wavelengths to their tristimulus "perceptual" XYZ values, as a
+  * table in constant memory. Next to it is the cumulative distribution used
+  * by the kernel to sample wavelengths, mostly proportional to X + Y + Z, so
+  * that few samples are spent on wavelengths which are almost invisible.
   *
   * This kernel object handles no queries.
 **/
 class Tristimulus : public KernelObject
 {
     private:
-        cl::Image2D buffer;
+        cl::Buffer buffer;
     public:
         Tristimulus(EngineParams& params);
         ~Tristimulus() { }
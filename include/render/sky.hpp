@@ -0,0 +1,41 @@
+#pragma once
+
+#include <engine/architecture.hpp>
+
+/** @file sky.hpp
+  * @brief Environment lighting.
+**/
+
+/** @class Sky
+  * @brief Analytic spectral sky.
+  *
+  * This kernel object lights the scene from every direction, with a sun and a
+  * clear sky, as described by the scene's optional sky.xml file (without it,
+  * escaped rays stay black). The sky is tabulated over a latitude-longitude
+  * map, of which each texel holds the strength of two black body spectra, the
+  * sky's and the sun's, so the kernel evaluates it at any wavelength. Next to
+  * the map, the marginal and conditional distributions of its visible power
+  * let the kernel sample directions towards the bright parts of the sky.
+  *
+  * This kernel object handles no queries.
+**/
+class Sky : public KernelObject
+{
+    private:
+        /** @brief The sky map, see \c Sky in sky.cl. **/
+        cl::Buffer map;
+
+        /** @brief The sky map's sampling distributions. **/
+        cl::Buffer cdf;
+
+        /** @brief The sky's parameters. **/
+        cl::Buffer buffer;
+
+    public:
+        Sky(EngineParams& params);
+        ~Sky() { }
+
+        void Bind(cl_uint* index);
+        void Update(size_t index);
+        void* Query(size_t query);
+};
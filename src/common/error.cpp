@@ -15,6 +15,7 @@ const std::string Error::Build = "Failed to build program, see log file.";
 const std::string Error::Kernel = "Failed to initialize kernel.";
 const std::string Error::Execute = "Failed to execute kernel.";
 const std::string Error::BuildLog = "Failed to retrieve CLC build log.";
+const std::string Error::Material = "Invalid material in materials.xml.";
 
 void Error::Check(std::string msg, int code, bool override)
 {
@@ -54,10 +55,12 @@ cl::Context CreateContext(std::vector<cl::Device>& devices)
     return context;
 }
 
-cl::CommandQueue CreateQueue(cl::Context& context, cl::Device& device)
+cl::CommandQueue CreateQueue(cl::Context& context, cl::Device& device,
+                             cl_command_queue_properties properties)
 {
     cl_int error;
-    cl::CommandQueue queue = cl::CommandQueue(context, device, 0, &error);
+    cl::CommandQueue queue = cl::CommandQueue(context, device, properties,
+                                              &error);
     Error::Check(Error::Queue, error);
     return queue;
 }
@@ -96,19 +99,40 @@ size_t GetWorkGroupSize(cl::Kernel& kernel, cl::Device& device)
     return workGroupSize;
 }
 
+size_t GetComputeUnits(cl::Device& device)
+{
+    cl_uint computeUnits;
+    cl_int error = device.getInfo(CL_DEVICE_MAX_COMPUTE_UNITS, &computeUnits);
+
+    Error::Check(Error::DeviceInfo, error);
+    return computeUnits;
+}
+
 void ExecuteKernel(cl::CommandQueue& queue, cl::Kernel& kernel,
-                   cl::NDRange offset, cl::NDRange global, cl::NDRange local)
+                   cl::NDRange offset, cl::NDRange global, cl::NDRange local,
+                   cl::Event* event)
 {
-    cl_int error = queue.enqueueNDRangeKernel(kernel, offset, global, local);
+    cl_int error = queue.enqueueNDRangeKernel(kernel, offset, global, local,
+                                              nullptr, event);
     Error::Check(Error::Execute, error);
 }
 
+void Flush(cl::CommandQueue& queue)
+{
+    Error::Check(Error::Execute, queue.flush());
+}
+
 void FlushAndWait(cl::CommandQueue& queue)
 {
     Error::Check(Error::Execute, queue.flush());
     Error::Check(Error::Execute, queue.finish());
 }
 
+void WaitForEvent(cl::Event& event)
+{
+    Error::Check(Error::Execute, event.wait());
+}
+
 cl::Buffer CreateBuffer(cl::Context& context, cl_mem_flags flags,
                         size_t size, void* hostptr)
 {
@@ -127,9 +151,10 @@ void WriteToBuffer(cl::CommandQueue& queue, cl::Buffer& buffer, cl_bool block,
 
 void ReadFromBuffer(cl::CommandQueue& queue, const cl::Buffer& buffer,
                     cl_bool block, size_t offset, size_t size,
-                    void* ptr)
+                    void* ptr, cl::Event* event)
 {
-    cl_int error = queue.enqueueReadBuffer(buffer, block, offset, size, ptr);
+    cl_int error = queue.enqueueReadBuffer(buffer, block, offset, size, ptr,
+                                           nullptr, event);
     Error::Check(Error::CLIO, error);
 }
 
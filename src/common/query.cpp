@@ -4,3 +4,4 @@ const size_t Query::Progress = 0;
 const size_t Query::TriangleCount = 1;
 const size_t Query::EstimatedTime = 2;
 const size_t Query::ElapsedTime = 3;
+const size_t Query::ActivePixels = 4;
@@ -0,0 +1,188 @@
+#include <engine/autotune.hpp>
+#include <engine/cache.hpp>
+
+#include <misc/pugixml.hpp>
+
+#include <algorithm>
+#include <cstdio>
+
+/* Smallest candidate work group size, below this devices are underused. */
+#define CANDIDATE_MIN 16
+
+Autotuner::Autotuner(std::string directory, std::string key, size_t maximum,
+                     bool dispatch2D, bool enabled)
+{
+    this->key = key;
+    this->tuned = true;
+
+    /* The default work group size, also used as the first candidate. */
+    if (!dispatch2D) best = WorkSize(maximum);
+    else
+    {
+        /* Use work groups as square as possible, covering pixel blocks. */
+        size_t y = 1;
+        while ((y * 2) * (y * 2) <= maximum) y *= 2;
+        best = WorkSize(maximum / y, y);
+    }
+
+    pugi::xml_document doc;
+    pugi::xml_node node;
+
+    if (!directory.empty())
+    {
+        this->directory = directory;
+        file = directory + "/profiles.xml";
+
+        if (doc.load_file(file.c_str()))
+        {
+            node = doc.child("profiles");
+            node = node.find_child_by_attribute("Key", key.c_str());
+
+            /* Profiles without a size only hold the timings so far. */
+            if (node && node.attribute("X"))
+            {
+                best.x = node.attribute("X").as_uint(best.x);
+                best.y = node.attribute("Y").as_uint(best.y);
+
+                fprintf(stderr, "Work group size loaded from profile.\n");
+                return;
+            }
+        }
+    }
+
+    if (!enabled) return;
+
+    candidates.push_back(best);
+    for (size_t size = CANDIDATE_MIN; size < maximum; size *= 2)
+    {
+        if (!dispatch2D) candidates.push_back(WorkSize(size));
+        else for (size_t y = 1; y * y <= size; y *= 2)
+            candidates.push_back(WorkSize(size / y, y));
+    }
+
+    /* Resume from the timings of an earlier, shorter render. */
+    times.assign(candidates.size(), -1.0);
+    for (pugi::xml_node c = node.child("candidate"); c;
+         c = c.next_sibling("candidate"))
+        for (size_t t = 0; t < candidates.size(); ++t)
+            if ((candidates[t].x == c.attribute("X").as_uint())
+             && (candidates[t].y == c.attribute("Y").as_uint()))
+                times[t] = c.attribute("Time").as_double(-1.0);
+
+    for (size_t t = 0; t < candidates.size(); ++t)
+        if (times[t] < 0) pending.push_back(t);
+
+    fprintf(stderr, "Autotuning over %lu work group sizes, %lu to time.\n",
+            (unsigned long)candidates.size(), (unsigned long)pending.size());
+    this->tuned = false;
+    if (pending.empty()) Finish();
+}
+
+WorkSize Autotuner::Select(size_t launch)
+{
+    /* The first launch warms the device up, and isn't timed. */
+    if (tuned || (launch == 0)) return best;
+    if (launch <= pending.size()) return candidates[pending[launch - 1]];
+
+    Finish();
+    return best;
+}
+
+void Autotuner::Record(size_t launch, cl::Event& event, size_t samples)
+{
+    if (tuned || (launch == 0) || (launch > pending.size())) return;
+
+    events.push_back(event);
+    this->samples.push_back(std::max(samples, (size_t)1));
+}
+
+void Autotuner::Stop()
+{
+    if (!tuned) Finish();
+}
+
+void Autotuner::Measure()
+{
+    for (size_t t = 0; t < events.size(); ++t)
+    {
+        cl_ulong start, end;
+        WaitForEvent(events[t]);
+        Error::Check(Error::Execute, events[t].getProfilingInfo(
+                     CL_PROFILING_COMMAND_START, &start));
+        Error::Check(Error::Execute, events[t].getProfilingInfo(
+                     CL_PROFILING_COMMAND_END, &end));
+
+        size_t index = pending[t];
+        times[index] = (double)(end - start) / samples[t];
+
+        unsigned long x = candidates[index].x, y = candidates[index].y;
+        fprintf(stderr, "--> %lux%lu: %.3f ns per sample.\n", x, y,
+                times[index]);
+    }
+
+    pending.erase(pending.begin(), pending.begin() + events.size());
+    events.clear();
+    samples.clear();
+}
+
+void Autotuner::Finish()
+{
+    Measure();
+    tuned = true;
+
+    if (!pending.empty())
+    {
+        fprintf(stderr, "Autotuning cut short, %lu work group sizes left to "
+                "time next run.\n\n", (unsigned long)pending.size());
+        Save();
+        return;
+    }
+
+    double fastest = -1.0;
+    for (size_t t = 0; t < candidates.size(); ++t)
+        if ((fastest < 0) || (times[t] < fastest))
+        {
+            fastest = times[t];
+            best = candidates[t];
+        }
+
+    fprintf(stderr, "Autotuning complete, using %lux%lu.\n\n",
+            (unsigned long)best.x, (unsigned long)best.y);
+    Save();
+}
+
+void Autotuner::Save()
+{
+    if (file.empty()) return;
+    MakeDirectory(directory);
+
+    pugi::xml_document doc;
+    doc.load_file(file.c_str());
+
+    pugi::xml_node root = doc.child("profiles");
+    if (!root) root = doc.append_child("profiles");
+
+    pugi::xml_node node = root.find_child_by_attribute("Key", key.c_str());
+    if (node) root.remove_child(node);
+
+    node = root.append_child("profile");
+    node.append_attribute("Key") = key.c_str();
+
+    if (pending.empty())
+    {
+        node.append_attribute("X") = (unsigned int)best.x;
+        node.append_attribute("Y") = (unsigned int)best.y;
+    }
+    else for (size_t t = 0; t < candidates.size(); ++t)
+    {
+        if (times[t] < 0) continue;
+
+        pugi::xml_node c = node.append_child("candidate");
+        c.append_attribute("X") = (unsigned int)candidates[t].x;
+        c.append_attribute("Y") = (unsigned int)candidates[t].y;
+        c.append_attribute("Time") = times[t];
+    }
+
+    if (!doc.save_file(file.c_str()))
+        fprintf(stderr, "Failed to save the work group size profile.\n");
+}
@@ -0,0 +1,83 @@
+#include <engine/benchmark.hpp>
+
+#include <cstdio>
+#include <sstream>
+
+/* Work-items launched for each sampler, enough to fill any device. */
+#define BENCH_ITEMS (1 << 20)
+
+/* Light paths per work-item, and random numbers per light path. */
+#define BENCH_PATHS 16
+#define BENCH_DIMENSIONS 32
+
+/* The samplers, with the build options selecting them. */
+static const char* samplers[][2] =
+{
+    { "random", "" },
+    { "philox", " -D SAMPLER_PHILOX" },
+    { "sobol",  " -D SAMPLER_SOBOL" },
+};
+
+void BenchmarkSamplers(cl::Context& context, cl::Device& device)
+{
+    std::vector<cl::Device> devices(&device, &device + 1);
+
+    /* The launches are timed with the device's profiler. */
+    cl::CommandQueue queue = CreateQueue(context, device,
+                                         CL_QUEUE_PROFILING_ENABLE);
+
+    cl_ulong4 key;
+    key.s[0] = key.s[1] = key.s[2] = key.s[3] = 0;
+    cl::Buffer seed = CreateBuffer(context,
+                                   CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                   sizeof(cl_ulong4), &key);
+    cl::Buffer sink = CreateBuffer(context, CL_MEM_WRITE_ONLY,
+                                   BENCH_ITEMS * sizeof(cl_float));
+
+    std::string src = "#include <bench.cl>\n";
+    cl::Program::Sources data(1, std::make_pair(src.c_str(), src.size()));
+
+    fprintf(stderr, "Benchmarking samplers.\n");
+
+    for (size_t t = 0; t < sizeof(samplers) / sizeof(*samplers); ++t)
+    {
+        std::stringstream options;
+        options << "-cl-std=CL1.1 -I cl/" << samplers[t][1];
+        options << " -D BENCH_PATHS=" << BENCH_PATHS;
+        options << " -D BENCH_DIMENSIONS=" << BENCH_DIMENSIONS;
+
+        cl::Program program = CreateProgram(context, data);
+        if (program.build(devices, options.str().c_str()) != CL_SUCCESS)
+        {
+            fprintf(stderr, "--> %s: build failed, log follows:\n\n%s\n\n",
+                    samplers[t][0], GetBuildLog(program, device).c_str());
+            continue;
+        }
+
+        cl::Kernel kernel = CreateKernel(program, "clbench");
+        BindArgument(kernel, seed, 0);
+        BindArgument(kernel, sink, 1);
+
+        /* Time the second launch, the first one may include warm-up. */
+        cl::Event event;
+        for (size_t run = 0; run < 2; ++run)
+        {
+            ExecuteKernel(queue, kernel, cl::NullRange,
+                          cl::NDRange(BENCH_ITEMS), cl::NullRange, &event);
+            WaitForEvent(event);
+        }
+
+        cl_ulong start, end;
+        Error::Check(Error::Execute, event.getProfilingInfo(
+                     CL_PROFILING_COMMAND_START, &start));
+        Error::Check(Error::Execute, event.getProfilingInfo(
+                     CL_PROFILING_COMMAND_END, &end));
+
+        double numbers = (double)BENCH_ITEMS * BENCH_PATHS * BENCH_DIMENSIONS;
+        double elapsed = (end - start) * 1e-9;
+        if (elapsed > 0) fprintf(stderr, "--> %s: %.3f Gnumbers/s.\n",
+                                 samplers[t][0], numbers / elapsed * 1e-9);
+    }
+
+    fprintf(stderr, "\n");
+}
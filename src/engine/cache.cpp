@@ -0,0 +1,163 @@
+#include <engine/cache.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+/* 64-bit FNV-1a hash, this isn't cryptographic, nor does it need to be. */
+static void Hash(uint64_t& hash, const std::string& data)
+{
+    for (size_t t = 0; t < data.size(); ++t)
+    {
+        hash ^= (unsigned char)data[t];
+        hash *= 0x100000001B3ULL;
+    }
+}
+
+void MakeDirectory(const std::string& path)
+{
+    #ifdef _WIN32
+    _mkdir(path.c_str());
+    #else
+    mkdir(path.c_str(), 0755);
+    #endif
+}
+
+/* Lists the files included by some source code, as #include <name>. */
+static void Includes(const std::string& source,
+                     std::vector<std::string>& names)
+{
+    std::istringstream lines(source);
+    std::string line;
+
+    while (std::getline(lines, line))
+    {
+        size_t pos = line.find_first_not_of(" \t");
+        if ((pos == std::string::npos) || (line.compare(pos, 8, "#include")))
+            continue;
+
+        size_t open = line.find('<', pos), close = line.find('>', pos);
+        if ((open != std::string::npos) && (close != std::string::npos))
+            names.push_back(line.substr(open + 1, close - open - 1));
+    }
+}
+
+void ProgramCache::HashFile(const std::string& name, uint64_t& hash,
+                            std::vector<std::string>& visited)
+{
+    if (std::find(visited.begin(), visited.end(), name) != visited.end())
+        return;
+    visited.push_back(name);
+
+    std::ifstream file("cl/" + name, std::ios::in | std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+
+    Hash(hash, name);
+    Hash(hash, contents.str());
+
+    std::vector<std::string> names;
+    Includes(contents.str(), names);
+    for (size_t t = 0; t < names.size(); ++t) HashFile(names[t], hash, visited);
+}
+
+ProgramCache::ProgramCache(std::string directory, cl::Device& device,
+                           const std::string& source,
+                           const std::string& options)
+{
+    this->directory = directory;
+
+    std::string name, driver;
+    DeviceName(device, name);
+    Error::Check(Error::DeviceInfo, device.getInfo(CL_DRIVER_VERSION, &driver));
+
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    Hash(hash, name);
+    Hash(hash, driver);
+    Hash(hash, options);
+    Hash(hash, source);
+
+    std::vector<std::string> names, visited;
+    Includes(source, names);
+    for (size_t t = 0; t < names.size(); ++t) HashFile(names[t], hash, visited);
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+    this->key = key;
+
+    if (directory.empty()) return;
+    this->path = directory + "/" + this->key + ".bin";
+
+    fprintf(stderr, "Kernel cache entry: %s.\n", path.c_str());
+}
+
+bool ProgramCache::Load(cl::Context& context, std::vector<cl::Device>& devices,
+                        const std::string& options, cl::Program& program)
+{
+    if (directory.empty()) return false;
+
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open()) return false;
+
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string binary = contents.str();
+    if (binary.empty()) return false;
+
+    cl::Program::Binaries binaries(1, std::make_pair(binary.data(),
+                                                     binary.size()));
+
+    cl_int error;
+    std::vector<cl_int> status;
+    cl::Program cached(context, devices, binaries, &status, &error);
+    if ((error != CL_SUCCESS) || (status.empty()) || (status[0] != CL_SUCCESS))
+    {
+        fprintf(stderr, "Cached kernel rejected, rebuilding.\n");
+        return false;
+    }
+
+    if (cached.build(devices, options.c_str()) != CL_SUCCESS)
+    {
+        fprintf(stderr, "Cached kernel failed to build, rebuilding.\n");
+        return false;
+    }
+
+    program = cached;
+    return true;
+}
+
+void ProgramCache::Store(cl::Program& program)
+{
+    if (directory.empty()) return;
+
+    std::vector<size_t> sizes;
+    cl_int error = program.getInfo(CL_PROGRAM_BINARY_SIZES, &sizes);
+    if ((error != CL_SUCCESS) || (sizes.size() != 1) || (sizes[0] == 0))
+    {
+        fprintf(stderr, "Kernel binary unavailable, not cached.\n");
+        return;
+    }
+
+    std::vector<char> binary(sizes[0]);
+    std::vector<char*> binaries(1, &binary[0]);
+    error = program.getInfo(CL_PROGRAM_BINARIES, &binaries);
+    if (error != CL_SUCCESS)
+    {
+        fprintf(stderr, "Kernel binary unavailable, not cached.\n");
+        return;
+    }
+
+    MakeDirectory(directory);
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    file.write(&binary[0], binary.size());
+
+    if (!file) fprintf(stderr, "Failed to write kernel cache entry.\n");
+    else fprintf(stderr, "Kernel binary cached.\n");
+}
@@ -1,8 +1,21 @@
 #include <engine/renderer.hpp>
 
+#include <algorithm>
+#include <sstream>
+
+/* Largest work group size the kernel's local memory is dimensioned for. */
+#define LOCAL_SIZE_MAX 128
+
+/* Work groups per compute unit in persistent mode (for latency hiding). */
+#define PERSISTENT_OCCUPANCY 4
+
+/* Samples per flush in half accumulation, each folded into an 11-bit mean. */
+#define HALF_FLUSH_SAMPLES 64
+
 Renderer::Renderer(size_t width, size_t height, size_t passes,
                    cl::Platform platform, cl::Device device,
-                   std::string source, std::string output)
+                   std::string source, std::string output,
+                   EngineOptions options)
 {
     params.platform = platform;
     params.device   = device;
@@ -11,33 +24,51 @@ Renderer::Renderer(size_t width, size_t height, size_t passes,
     params.passes   = passes;
     params.source   = source;
     params.output   = output;
+    params.options  = options;
     currentPass = 0;
+    samples = 0;
 
-    fprintf(stderr, "Initializing OpenCL context.\n");
+    /* Light tracing samples land anywhere, so every pixel needs as many. */
+    if (options.integrator != "path") params.options.adaptiveInterval = 0;
 
-    /* For some reason, cl::Context requires a vector.. */
-    std::vector<cl::Device> devices(&device, &device + 1);
+    /* Only unidirectional light paths are ever split. */
+    if (options.integrator != "path") params.options.maxSplit = 1;
 
-    params.context = CreateContext(devices);
-    params.queue = CreateQueue(params.context, device);
+    /* Each SPPM iteration is a single pass, traced by a single launch. */
+    if (options.integrator == "sppm") params.options.samplesPerLaunch = 1;
 
-    fprintf(stderr, "Building OpenCL kernel.\n");
+    /* Light tracing adds to arbitrary pixels, while adaptive sampling and *
+     * splitting read the pixels' totals, these all need the float sums.  */
+    if ((options.integrator != "path") || params.options.adaptiveInterval
+     || (params.options.maxSplit > 1)) params.options.accumulation = "float";
+
+    /* The mean loses the samples' low bits each time one is folded in, *
+     * so flushes mustn't cover more samples than it can keep track of.  */
+    if (params.options.accumulation == "half")
+    {
+        size_t& samples = params.options.samplesPerLaunch;
+        samples = std::min(samples, (size_t)HALF_FLUSH_SAMPLES);
+        params.options.flushInterval = std::max((size_t)1,
+            std::min(params.options.flushInterval,
+                     (size_t)HALF_FLUSH_SAMPLES / samples));
+    }
 
-    /* Cheap trick, for loading CL kernels. */
-    const char* src = "#include <epsilon.cl>";
+    /* Adaptive sampling dispatches a list of pixels, in one dimension. */
+    if (params.options.adaptiveInterval) params.options.dispatch2D = false;
 
-    cl::Program::Sources data; /* Don't need multi-kernel support. */
-    data = cl::Program::Sources(1, std::make_pair(src, strlen(src)));
+    fprintf(stderr, "Initializing OpenCL context.\n");
 
-    params.program = CreateProgram(params.context, data);
+    /* For some reason, cl::Context requires a vector.. */
+    std::vector<cl::Device> devices(&device, &device + 1);
 
-    params.program.build(devices, "-cl-std=CL1.1 -I cl/");
-    std::string log = GetBuildLog(params.program, params.device);
+    params.context = CreateContext(devices);
 
-    fprintf(stderr, "CLC build log follows:\n\n");
-    fprintf(stderr, "%s\n\n", log.c_str());
+    /* Autotuning times the kernel launches with the device's profiler. */
+    cl_command_queue_properties properties = 0;
+    if (options.autotune) properties |= CL_QUEUE_PROFILING_ENABLE;
+    params.queue = CreateQueue(params.context, device, properties);
 
-    params.kernel = CreateKernel(params.program, "clmain");
+    if (options.benchmarkSamplers) BenchmarkSamplers(params.context, device);
 
     fprintf(stderr, "Loading all kernel objects.\n\n");
 
@@ -46,72 +77,243 @@ Renderer::Renderer(size_t width, size_t height, size_t passes,
     objects.push_back(new Tristimulus (params));
     objects.push_back(new Geometry    (params));
     objects.push_back(new Materials   (params));
+    objects.push_back(new Sky         (params));
     objects.push_back(new Camera      (params));
+    if (options.integrator == "sppm")
+        objects.push_back(new PhotonMap(params));
     objects.push_back(new PRNG        (params));
+    objects.push_back(new WorkQueue   (params));
     objects.push_back(new Progress    (params));
 
+    fprintf(stderr, "Building OpenCL kernel.\n");
+
+    /* Cheap trick, for loading CL kernels, after the scene's constants. */
+    std::string src = Prelude() + "#include <epsilon.cl>\n";
+
+    std::string buildOptions = BuildOptions();
+    fprintf(stderr, "Build options: %s\n", buildOptions.c_str());
+
+    /* Reuse the kernel binary from a previous run, if possible. */
+    ProgramCache cache(options.cacheDir, device, src, buildOptions);
+
+    if (cache.Load(params.context, devices, buildOptions, params.program))
+        fprintf(stderr, "Loaded kernel from cache.\n\n");
+    else
+    {
+        cl::Program::Sources data; /* Don't need multi-kernel support. */
+        data = cl::Program::Sources(1, std::make_pair(src.c_str(),
+                                                      src.size()));
+
+        params.program = CreateProgram(params.context, data);
+
+        cl_int error = params.program.build(devices, buildOptions.c_str());
+        std::string log = GetBuildLog(params.program, params.device);
+
+        fprintf(stderr, "CLC build log follows:\n\n");
+        fprintf(stderr, "%s\n\n", log.c_str());
+
+        if (error == CL_SUCCESS) cache.Store(params.program);
+    }
+
+    std::string name = "clmain";
+    if (options.integrator == "bdpt") name = "clbdpt";
+    if (options.integrator == "sppm") name = "clsppm";
+    params.kernel = CreateKernel(params.program, name.c_str());
+
+    /* Modes using local memory are limited in their work group size. */
+    size_t local = GetWorkGroupSize(params.kernel, params.device);
+    if (options.sortShading || options.sortRays)
+        local = std::min(local, (size_t)LOCAL_SIZE_MAX);
+
+    unsigned long loc = local; /* Damn you, size_t! */
+    fprintf(stderr, "Local work group size reported: %lu.\n", loc);
+
+    bool dispatch2D = params.options.dispatch2D && !options.persistent;
+    tuner = new Autotuner(options.cacheDir, cache.Key(), local, dispatch2D,
+                          options.autotune);
+
     cl_uint slot = 0;
     for (size_t t = 0; t < objects.size(); ++t) objects[t]->Bind(&slot);
 }
 
 Renderer::~Renderer()
 {
+    /* Don't free anything the device or its callbacks may still be using. */
+    params.queue.finish();
+
     fprintf(stderr, "Freeing all kernel objects.\n");
     for (size_t t = 0; t < objects.size(); ++t) delete objects[t];
+    delete tuner;
 }
 
 bool Renderer::Execute()
 {
     /* Guard to prevent doing redundant passes. */
-    if (currentPass == params.passes) return true;
+    if (currentPass == params.Launches()) return true;
+
+    /* With adaptive sampling, the render may converge before the end. */
+    cl_uint* active = (cl_uint*)Query(Query::ActivePixels);
+    if (active && (*active == 0))
+    {
+        unsigned long launches = currentPass;
+        fprintf(stderr, "All pixels converged after %lu launches.\n\n",
+                launches);
+
+        currentPass = params.Launches();
+        Finish();
+        return true;
+    }
+
     bool info = (currentPass == 0);
     if (info) fprintf(stderr, "Executing first pass.\n");
     else if (currentPass == 1) fprintf(stderr, "Executing passes...\n\n");
 
-    size_t local = GetWorkGroupSize(params.kernel, params.device);
-    size_t global = params.width * params.height;
-    size_t offset = 0;
+    WorkSize size = tuner->Select(currentPass);
+    cl::NDRange localSize, globalSize;
 
-    if (info)
+    if (params.options.persistent)
     {
-        unsigned long loc = local; /* Damn you, size_t! */
-        fprintf(stderr, "--> Local work group size reported: %lu.\n", loc);
-        fprintf(stderr, "--> Initiating iterative problem reduction.\n");
-    }
+        /* Launch just enough work groups to keep the device busy, they *
+         * will then fetch pixels to render until there are none left.  */
+        size_t groups = GetComputeUnits(params.device) * PERSISTENT_OCCUPANCY;
+        localSize = cl::NDRange(size.x);
+        globalSize = cl::NDRange(size.x * groups);
 
-    while (global != 0)
-    {
-        size_t reduced = global % local;
-        size_t slice = global - reduced;
         if (info)
         {
-            unsigned long glo = global, red = reduced;
-            fprintf(stderr, "-----> Reducing %lu to %lu.\n", glo, red);
+            unsigned long grp = groups;
+            fprintf(stderr, "--> Launching %lu persistent groups.\n", grp);
         }
+    }
+    else if (params.options.dispatch2D)
+    {
+        /* Work groups cover blocks of pixels. */
+        localSize = cl::NDRange(size.x, size.y);
+        globalSize = cl::NDRange(RoundUp(params.width, size.x),
+                                 RoundUp(params.height, size.y));
 
-        if (slice >= local)
+        if (info)
         {
-            cl::NDRange localSize(local), globalSize(slice);
-            cl::NDRange offsetRange(offset);
+            unsigned long x = size.x, y = size.y;
+            fprintf(stderr, "--> Launching 2D, %lux%lu blocks.\n", x, y);
+        }
+    }
+    else
+    {
+        /* One work-item per pixel, padded to a whole number of groups. */
+        size_t pixels = active ? *active : params.PixelSlots();
+        localSize = cl::NDRange(size.x);
+        globalSize = cl::NDRange(RoundUp(pixels, size.x));
 
-            if (info) fprintf(stderr, "-----> Launching kernel.\n");
-            ExecuteKernel(params.queue, params.kernel, offsetRange,
-                          globalSize, localSize);
+        if (info)
+        {
+            unsigned long pad = RoundUp(pixels, size.x) - pixels;
+            fprintf(stderr, "--> Launching 1D, %lu padding.\n", pad);
         }
+    }
 
-        global = global % local;
-        offset += slice;
-        local /= 2;
+    /* Keep at most a few launches in flight, waiting for the oldest. */
+    while (inFlight.size() >= params.options.launchesInFlight)
+    {
+        WaitForEvent(inFlight.front());
+        inFlight.pop_front();
     }
 
-    FlushAndWait(params.queue);
+    ExecuteKernel(params.queue, params.kernel, cl::NullRange,
+                  globalSize, localSize, &params.launch);
+    inFlight.push_back(params.launch);
+
+    /* Candidates are compared by time per sample, see Autotuner. */
+    size_t first = currentPass * params.options.samplesPerLaunch;
+    size_t passes = std::min(params.options.samplesPerLaunch,
+                             params.passes - first);
+    tuner->Record(currentPass, params.launch,
+                  (active ? *active : params.PixelSlots()) * passes);
+
+    /* Converged pixels aren't rendered, so only count the active ones. */
+    samples += (double)(active ? *active : params.width * params.height)
+             * passes;
 
+    /* Objects prepare the next launch while this one is being rendered. */
     if (info) fprintf(stderr, "--> Updating all kernel objects.\n");
     for (size_t t = 0; t < objects.size(); ++t)
         objects[t]->Update(currentPass);
 
-    if (info) fprintf(stderr, "Pass complete.\n\n");
-    return (++currentPass == params.passes);
+    Flush(params.queue);
+
+    if (info) fprintf(stderr, "Pass enqueued.\n\n");
+    if (++currentPass < params.Launches()) return false;
+
+    /* This was the last launch, so wait for the device to catch up. */
+    Finish();
+    return true;
+}
+
+void Renderer::Finish()
+{
+    FlushAndWait(params.queue);
+    inFlight.clear();
+    tuner->Stop();
+
+    /* Report the overall throughput, to compare engine options. */
+    double elapsed = *(double*)Query(Query::ElapsedTime);
+    if (elapsed > 0) fprintf(stderr, "Rendered %.3f Msamples/s.\n\n",
+                             samples / elapsed * 1e-6);
+}
+
+std::string Renderer::BuildOptions()
+{
+    std::stringstream options;
+    options << "-cl-std=CL1.1 -I cl/";
+    options << " -D LOCAL_SIZE_MAX=" << LOCAL_SIZE_MAX;
+    options << " -D SPECTRAL_RESOLUTION=" << Spectral::Resolution();
+
+    if (params.options.sortShading) options << " -D KERNEL_MODE_SORTED";
+    if (params.options.persistent) options << " -D KERNEL_MODE_PERSISTENT";
+    if (params.options.dispatch2D) options << " -D KERNEL_MODE_2D";
+    options << " -D TILE_SIZE=" << params.options.tileSize;
+    if (params.options.sortRays) options << " -D KERNEL_MODE_RAYSORT";
+    if (params.options.nextEvent) options << " -D KERNEL_MODE_NEE";
+    if (params.options.lightTree) options << " -D KERNEL_MODE_LIGHTTREE";
+    if (params.options.adaptiveInterval) options << " -D KERNEL_MODE_ADAPTIVE";
+    if (params.options.accumulation == "half")
+        options << " -D KERNEL_MODE_HALF";
+    options << " -D RR_DEPTH=" << params.options.rouletteDepth;
+    if (params.options.maxSplit > 1)
+    {
+        options << " -D KERNEL_MODE_SPLIT";
+        options << " -D SPLIT_MAX=" << params.options.maxSplit;
+    }
+    if (params.options.integrator == "bdpt") options << " -D KERNEL_MODE_BDPT";
+    if (params.options.integrator == "sppm")
+    {
+        options << " -D KERNEL_MODE_SPPM";
+        options << " -D SPPM_PHOTONS=" << params.Photons();
+        options << " -D SPPM_RADIUS=" << params.options.photonRadius << "f";
+    }
+
+    if (params.options.sampler == "sobol")
+    {
+        options << " -D SAMPLER_SOBOL";
+        if (params.options.blueNoise) options << " -D SAMPLER_BLUE_NOISE";
+    }
+    else if (params.options.sampler == "philox")
+        options << " -D SAMPLER_PHILOX";
+
+    return options.str();
+}
+
+std::string Renderer::Prelude()
+{
+    if (!params.options.specialize) return "";
+
+    std::stringstream prelude;
+    for (size_t t = 0; t < objects.size(); ++t)
+        objects[t]->Specialize(prelude);
+
+    fprintf(stderr, "Kernel prelude follows:\n\n%s\n",
+            prelude.str().c_str());
+    return prelude.str();
 }
 
 void* Renderer::Query(size_t query)
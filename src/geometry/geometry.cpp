@@ -1,8 +1,11 @@
 #include <geometry/geometry.hpp>
+#include <geometry/lighttree.hpp>
+#include <material/material.hpp>
 #include <misc/xmlutils.hpp>
 #include <misc/pugixml.hpp>
 #include <math/aabb.hpp>
 
+#include <map>
 #include <memory>
 #include <set>
 
@@ -15,6 +18,13 @@ struct cl_triangle
     cl_float4 b; /* The triangle's bitangent. */
     cl_float4 n; /* The triangle's normal.    */
     cl_uint mat; /* The triangle's material.  */
+    cl_uint light; /* Its light tree trail.   */
+};
+
+struct cl_light
+{
+    cl_uint triangle; /* The emissive triangle.           */
+    cl_float cdf;     /* The area distribution, up to it. */
 };
 
 
@@ -41,6 +51,10 @@ class Triangle
         /** @brief The triangle's model ID. **/
         std::string model;
 
+        /** @brief The triangle's trail in the light tree, if it emits light.
+        **/
+        uint32_t light;
+
         /** @brief Creates the triangle from three points (vertices).
           * @param p1 The first vertex.
           * @param p2 The second vertex.
@@ -57,6 +71,14 @@ class Triangle
         **/
         Vector Centroid() { return this->centroid; }
 
+        /** @brief Returns the triangle's area.
+        **/
+        float Area() { return 0.5f * length(cross(this->x, this->y)); }
+
+        /** @brief Returns the triangle's unit normal.
+        **/
+        Vector Normal() { return this->n; }
+
         /** @brief Converts the triangle to a device-side representation.
           * @param out A pointer to write the output to.
         **/
@@ -209,6 +231,7 @@ Triangle::Triangle(Vector p1, Vector p2, Vector p3, std::string modelID)
     this->centroid = (p1 + p2 + p3) / 3.0f;
 
     this->model = modelID;
+    this->light = 0;
 }
 
 /* This will format the triangle for export to the OpenCL device, with enough *
@@ -217,6 +240,7 @@ Triangle::Triangle(Vector p1, Vector p2, Vector p3, std::string modelID)
 void Triangle::CL(cl_triangle *out)
 {
     out->mat = material;
+    out->light = light;
     p1.CL(&out->p);
     x.CL(&out->x);
     y.CL(&out->y);
@@ -394,6 +418,72 @@ Geometry::Geometry(EngineParams& params) : KernelObject(params)
 
     delete[] bvhTree;
 
+    fprintf(stderr, "\nBuilding light list.\n");
+
+    /* The triangles are now in their final order, so gather the lights. */
+    std::fstream matStream;
+    pugi::xml_document matDoc;
+    GetData("materials.xml", matStream);
+    ParseXML(matDoc, matStream);
+
+    std::map<std::string, float> emitters = Materials::Emitters(matDoc);
+    std::vector<cl_light> lightList;
+    std::vector<Emitter> emitterList;
+    double area = 0;
+
+    for (size_t t = 0; t < count; ++t)
+    {
+        auto emitter = emitters.find(triangleList[t]->model);
+        if (emitter == emitters.end()) continue;
+
+        cl_light light = { (cl_uint)t, 0 };
+        area += triangleList[t]->Area();
+        light.cdf = (cl_float)area;
+        lightList.push_back(light);
+
+        Emitter e;
+        e.bounds = triangleList[t]->BoundingBox();
+        e.normal = triangleList[t]->Normal();
+        e.power = triangleList[t]->Area()
+                * LightTree::VisiblePower(emitter->second);
+        e.triangle = (uint32_t)t;
+        e.trail = 0;
+        emitterList.push_back(e);
+    }
+
+    for (size_t t = 0; t < lightList.size(); ++t)
+        lightList[t].cdf = (t == lightList.size() - 1) ? 1.0f
+                         : (cl_float)(lightList[t].cdf / area);
+
+    this->lightCount = lightList.size();
+    this->lightArea = (cl_float)area;
+    fprintf(stderr, "%u emissive triangles, total area %.3f.\n",
+            lightCount, lightArea);
+
+    /* Each triangle remembers its way down the tree, for MIS weights. */
+    LightTree tree(emitterList);
+    for (const Emitter& e : emitterList)
+        triangleList[e.triangle]->light = e.trail;
+
+    std::vector<cl_light_node> treeNodes = tree.Nodes();
+    fprintf(stderr, "Light tree has %lu nodes.\n",
+            (unsigned long)treeNodes.size());
+
+    /* Buffers can't be empty, the kernel won't read this entry anyway. */
+    if (lightList.empty()) lightList.push_back(cl_light());
+    if (treeNodes.empty()) treeNodes.push_back(cl_light_node());
+
+    this->lights = CreateBuffer(params.context,
+                                CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                sizeof(cl_light) * lightList.size(),
+                                &lightList[0]);
+
+    this->lightTree = CreateBuffer(params.context,
+                                   CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                   sizeof(cl_light_node) * treeNodes.size(),
+                                   &treeNodes[0]);
+
+    fprintf(stderr, "Light data uploaded!\n");
     fprintf(stderr, "\nCompacting triangle list.\n");
 
     cl_triangle* raw = new cl_triangle[count];
@@ -425,6 +515,12 @@ void Geometry::Bind(cl_uint* index)
     BindArgument(params.kernel, triangles, (*index)++);
     fprintf(stderr, "Binding <nodes@Geometry> to index %u.\n", *index);
     BindArgument(params.kernel, nodes, (*index)++);
+    fprintf(stderr, "Binding <lights@Geometry> to index %u.\n", *index);
+    BindArgument(params.kernel, lights, (*index)++);
+    fprintf(stderr, "Binding <lightTree@Geometry> to index %u.\n", *index);
+    BindArgument(params.kernel, lightTree, (*index)++);
+    BindArgument(params.kernel, lightCount, (*index)++);
+    BindArgument(params.kernel, lightArea, (*index)++);
 }
 
 void Geometry::Update(size_t /* index */) { return; }
@@ -0,0 +1,101 @@
+#include <geometry/lighttree.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+/* Merges a two-sided normal cone into another, given by axis and angle. */
+static void MergeCone(Vector *axis, float *angle, Vector other, float spread)
+{
+    /* The emitters are two-sided, so either direction of an axis will do. */
+    if (dot(*axis, other) < 0) other = other * -1.0f;
+    if (*angle < spread) { std::swap(*axis, other); std::swap(*angle, spread); }
+
+    float between = std::acos(std::min(dot(*axis, other), 1.0f));
+    if (between + spread <= *angle) return;
+
+    /* A two-sided cone this wide already covers every direction. */
+    float merged = 0.5f * (*angle + between + spread);
+    if (merged >= 0.5f * PI) { *angle = 0.5f * PI; return; }
+
+    /* Rotate the axis towards the other one, to center the merged cone. */
+    float rotation = merged - *angle;
+    Vector ortho = normalize(other - *axis * dot(*axis, other));
+    *axis = normalize(*axis * std::cos(rotation) + ortho * std::sin(rotation));
+    *angle = merged;
+}
+
+/* Returns the center of an emitter's bounding box. */
+static Vector Center(const Emitter& emitter)
+{
+    return (emitter.bounds.min + emitter.bounds.max) * 0.5f;
+}
+
+void LightTree::Build(std::vector<Emitter>& emitters, size_t start,
+                      size_t end, uint32_t trail, uint32_t depth)
+{
+    size_t index = nodes.size();
+    nodes.push_back(cl_light_node());
+
+    AABB bounds = emitters[start].bounds;
+    AABB centers(Center(emitters[start]));
+    Vector axis = emitters[start].normal;
+    float angle = 0, power = 0;
+
+    for (size_t t = start; t < end; ++t)
+    {
+        bounds.ExpandToInclude(emitters[t].bounds);
+        centers.ExpandToInclude(Center(emitters[t]));
+        MergeCone(&axis, &angle, emitters[t].normal, 0);
+        power += emitters[t].power;
+    }
+
+    bounds.min.CL(&nodes[index].min);
+    bounds.max.CL(&nodes[index].max);
+    axis.CL(&nodes[index].axis);
+    nodes[index].min.s[3] = power;
+    nodes[index].max.s[3] = angle;
+    nodes[index].data.s[0] = 0;
+    nodes[index].data.s[1] = emitters[start].triangle;
+    nodes[index].data.s[2] = 0;
+    nodes[index].data.s[3] = 0;
+
+    if (end - start == 1)
+    {
+        emitters[start].trail = trail;
+        return;
+    }
+
+    /* Split at the median, along the longest axis. */
+    size_t mid = (start + end) / 2;
+    int dim = centers.Split();
+    std::nth_element(emitters.begin() + start, emitters.begin() + mid,
+                     emitters.begin() + end,
+                     [dim](const Emitter& a, const Emitter& b)
+                     { return Center(a)[dim] < Center(b)[dim]; });
+
+    Build(emitters, start, mid, trail, depth + 1);
+    nodes[index].data.s[0] = nodes.size();
+    Build(emitters, mid, end, trail | (1u << depth), depth + 1);
+}
+
+LightTree::LightTree(std::vector<Emitter>& emitters)
+{
+    if (!emitters.empty()) Build(emitters, 0, emitters.size(), 0, 0);
+}
+
+float LightTree::VisiblePower(float temperature)
+{
+    /* Same black body spectrum as the kernel, integrated over 380-780nm. */
+    const size_t steps = 80;
+    double power = 0;
+
+    for (size_t t = 0; t <= steps; ++t)
+    {
+        double w = (380 + 400.0 * t / steps) * 1e-9;
+        double b = 3.74183e-16 / std::pow(w, 5)
+                 / (std::exp(1.4388e-2 / (w * temperature)) - 1);
+        power += b * ((t == 0 || t == steps) ? 0.5 : 1.0);
+    }
+
+    return (float)(power * 400e-9 / steps);
+}
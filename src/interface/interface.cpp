@@ -2,6 +2,8 @@
 
 #include <misc/pugixml.hpp>
 
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
 
 /* These are constants corresponding to lines on the interface terminal. */
@@ -184,6 +186,60 @@ bool Interface::GetInput()
             defWidth = node.child("Render").attribute("Width").as_int();
             defHeight = node.child("Render").attribute("Height").as_int();
             defPasses = node.child("Render").attribute("Passes").as_int();
+
+            /* Advanced options, these are never asked for. */
+            pugi::xml_node engine = node.child("Engine");
+            options.sortShading = engine.attribute("SortShading").as_bool();
+            options.persistent = engine.attribute("Persistent").as_bool();
+            options.samplesPerLaunch = std::max(1u,
+                engine.attribute("SamplesPerLaunch").as_uint(1));
+            options.dispatch2D = engine.attribute("Dispatch2D").as_bool();
+            options.launchesInFlight = std::max(1u,
+                engine.attribute("LaunchesInFlight").as_uint(2));
+
+            /* Round the tile size down to a power of two. */
+            size_t tile = engine.attribute("TileSize").as_uint(0);
+            for (size_t t = 1; t <= tile; t *= 2) options.tileSize = t;
+
+            options.sortRays = engine.attribute("SortRays").as_bool();
+            options.specialize = engine.attribute("Specialize").as_bool(true);
+            options.cacheDir = engine.attribute("CacheDir").as_string("cache");
+            options.autotune = engine.attribute("Autotune").as_bool();
+            options.sampler = engine.attribute("Sampler").as_string("random");
+            options.blueNoise = engine.attribute("BlueNoise").as_bool();
+            options.benchmarkSamplers =
+                engine.attribute("BenchmarkSamplers").as_bool();
+            options.nextEvent = engine.attribute("NextEvent").as_bool(true);
+            options.lightTree = engine.attribute("LightTree").as_bool(true);
+            options.adaptiveInterval =
+                engine.attribute("AdaptiveInterval").as_uint(0);
+            options.adaptiveThreshold =
+                engine.attribute("AdaptiveThreshold").as_float(0.02f);
+            options.adaptiveMinSamples =
+                engine.attribute("AdaptiveMinSamples").as_uint(0);
+            options.integrator =
+                engine.attribute("Integrator").as_string("path");
+
+            /* Other options depend on the integrator, don't guess at it. */
+            if ((options.integrator != "bdpt")
+             && (options.integrator != "sppm")
+             && (options.integrator != "path"))
+            {
+                fprintf(stderr, "Unknown integrator '%s', using 'path'.\n",
+                        options.integrator.c_str());
+                options.integrator = "path";
+            }
+
+            options.photonCount = engine.attribute("PhotonCount").as_uint(0);
+            options.photonRadius =
+                engine.attribute("PhotonRadius").as_float(0.005f);
+            options.rouletteDepth =
+                engine.attribute("RouletteDepth").as_uint(3);
+            options.maxSplit = engine.attribute("MaxSplit").as_uint(1);
+            options.accumulation =
+                engine.attribute("Accumulation").as_string("float");
+            options.flushInterval =
+                engine.attribute("FlushInterval").as_uint(16);
         }
 
         stream.close();
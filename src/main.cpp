@@ -71,7 +71,8 @@ int main(/* int argc, char* argv[] */)
                                 interface->platform,
                                 interface->device,
                                 interface->source,
-                                interface->output);
+                                interface->output,
+                                interface->options);
 
         interface->DisplayStatus("Rendering...", false);
 
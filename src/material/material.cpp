@@ -1,10 +1,142 @@
 #include <material/material.hpp>
+#include <material/volume.hpp>
 
 #include <misc/xmlutils.hpp>
 #include <misc/pugixml.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <set>
 
+/* Default nesting depth, as used by the kernel if it isn't specialized. */
+#define MT_DEFAULT 4
+
+/* Material models, these must match the MODEL_* definitions in material.cl. */
+#define MODEL_NONE       0
+#define MODEL_LIGHT      1
+#define MODEL_MATTE      2
+#define MODEL_MATTE_PEAK 3
+#define MODEL_GLASS      4
+
+/* Device-side representation. */
+struct cl_material
+{
+    cl_float4 params;   /* The model's parameters.                 */
+    cl_float index;     /* Refractive index, negative if none.     */
+    cl_float absorption;/* Absorption strength, zero if none.      */
+    cl_uint model;      /* The material's model.                   */
+    cl_uint volume;     /* Density grid, zero if homogeneous.      */
+    cl_float tint;      /* Wavelength let through, zero if grey.   */
+    cl_uint padding[3]; /* The kernel aligns this to 16 bytes.     */
+};
+
+/* Builds a material table entry, unused parameters are zero. */
+static cl_material Material(cl_uint model, float p0 = 0, float p1 = 0,
+                            float p2 = 0, float index = -1.0f,
+                            float absorption = 0.0f, float tint = 650.0f)
+{
+    cl_material material;
+    memset(&material, 0, sizeof(cl_material));
+
+    material.model = model;
+    material.params.s[0] = p0;
+    material.params.s[1] = p1;
+    material.params.s[2] = p2;
+    material.index = index;
+    material.absorption = absorption;
+    material.tint = tint;
+    return material;
+}
+
+/* The built-in materials, with the MatID's defined in material.cl. */
+static std::vector<cl_material> Presets()
+{
+    std::vector<cl_material> presets;
+    presets.push_back(Material(MODEL_NONE, 0, 0, 0, 1.0f));
+    presets.push_back(Material(MODEL_LIGHT, 3500.0f));
+    presets.push_back(Material(MODEL_MATTE_PEAK, 525, 0.01f, 0.55f));
+    presets.push_back(Material(MODEL_MATTE_PEAK, 640, 0.001f, 0.55f));
+    presets.push_back(Material(MODEL_MATTE_PEAK, 460, 0.001f, 0.55f));
+    presets.push_back(Material(MODEL_MATTE, 0.8f));
+    presets.push_back(Material(MODEL_GLASS, 0.9f, 0, 0, 1.55f, 1.2f));
+    presets.push_back(Material(MODEL_GLASS, 0.9f, 0, 0, 1.55f, 0.08f));
+    return presets;
+}
+
+/* Parses a material from its XML node, which either refers to a built-in *
+ * material by MatID, or gives a model and its parameters as attributes.  */
+static cl_material ParseMaterial(pugi::xml_node node,
+                                 const std::vector<cl_material>& presets)
+{
+    if (!node.attribute("Model"))
+    {
+        size_t matID = node.attribute("MatID").as_uint();
+
+        /* Unknown material ID's used to have no properties at all. */
+        if (matID >= presets.size()) return Material(MODEL_NONE);
+        return presets[matID];
+    }
+
+    std::string model = node.attribute("Model").value();
+    float index = node.attribute("Index").as_float(-1.0f);
+    float absorption = node.attribute("Absorption").as_float(0.0f);
+    float tint = node.attribute("Tint").as_float(650.0f);
+
+    if (model == "none")
+        return Material(MODEL_NONE, 0, 0, 0, index, absorption, tint);
+
+    if (model == "light")
+        return Material(MODEL_LIGHT,
+                        node.attribute("Temperature").as_float(6500.0f),
+                        0, 0, index, absorption, tint);
+
+    if (model == "matte")
+        return Material(MODEL_MATTE,
+                        node.attribute("Albedo").as_float(0.8f),
+                        0, 0, index, absorption, tint);
+
+    if (model == "matte_peak")
+        return Material(MODEL_MATTE_PEAK,
+                        node.attribute("Peak").as_float(550.0f),
+                        node.attribute("Deviation").as_float(0.001f),
+                        node.attribute("Albedo").as_float(0.55f),
+                        index, absorption, tint);
+
+    if (model == "glass")
+        return Material(MODEL_GLASS,
+                        node.attribute("Loss").as_float(0.9f),
+                        0, 0, node.attribute("Index").as_float(1.5f),
+                        absorption, tint);
+
+    fprintf(stderr, "Unknown material model '%s'.\n", model.c_str());
+    Error::Check(Error::Material, 0, true);
+    return Material(MODEL_NONE);
+}
+
+/* Parses a material, along with its medium's density grid, if it has one. */
+static cl_material ParseMedium(pugi::xml_node node,
+                               const std::vector<cl_material>& presets,
+                               Volumes& volumes, const std::string& source)
+{
+    cl_material material = ParseMaterial(node, presets);
+
+    if (node.child("density"))
+        material.volume = volumes.Load(node.child("density"), source);
+
+    return material;
+}
+
+/* Adds a material to the table, unless it is already in it. Materials must *
+ * be deduplicated, as the kernel tells media apart by their material ID.   */
+static cl_uint Insert(std::vector<cl_material>& table, cl_material material)
+{
+    for (size_t t = 0; t < table.size(); ++t)
+        if (!memcmp(&table[t], &material, sizeof(cl_material))) return t;
+
+    table.push_back(material);
+    return table.size() - 1;
+}
+
 Materials::Materials(EngineParams& params) : KernelObject(params)
 {
     fprintf(stderr, "Initializing <Materials>.\n");
@@ -26,37 +158,102 @@ Materials::Materials(EngineParams& params) : KernelObject(params)
         modelList.insert(modelID);
     }
 
-    /* ModelID - MatID mapping. */
+    /* The built-in materials always come first. */
+    std::vector<cl_material> presets = Presets(), table = presets;
+    Volumes volumes;
+
+    /* ModelID - MatID mapping, the atmosphere comes first. */
     std::vector<cl_uint> matMapping;
-    matMapping.resize(modelList.size() + 1);
-    
-    /* Get the atmospheric material. */
     pugi::xml_node node = doc.child("materials").child("atmosphere");
-    matMapping.push_back(node.attribute("MatID").as_uint());
+    matMapping.push_back(Insert(table, ParseMedium(node, presets, volumes,
+                                                   params.source)));
 
-    size_t index = 1;
     std::set<std::string>::iterator iter;
     for (iter = modelList.begin(); iter != modelList.end(); ++iter)
     {
-        /* Map this Model ID to the desired material ID. */
+        /* Map this Model ID to the desired material. */
         pugi::xml_node node = doc.child("materials");
         node = node.find_child_by_attribute("ModelID", (*iter).c_str());
 
-        matMapping[index++] = node.attribute("MatID").as_uint();
+        matMapping.push_back(Insert(table, ParseMedium(node, presets,
+                                                       volumes,
+                                                       params.source)));
     }
 
+    fprintf(stderr, "Material table has %lu entries.\n",
+            (unsigned long)table.size());
+    fprintf(stderr, "Scene has %lu heterogeneous media.\n",
+            (unsigned long)volumes.Count());
+    this->volumeCount = volumes.Count();
+
+    /* Find out which models the scene uses, for specialization. */
+    std::set<cl_uint> used(matMapping.begin(), matMapping.end());
+    this->models = 0;
+    for (cl_uint matID : used) this->models |= 1u << table[matID].model;
+
+    /* The media stack can't be deeper than the number of materials, unless *
+     * the same materials are nested in each other, so let the scene say.   */
+    node = doc.child("materials");
+    this->nesting = node.attribute("Nesting").as_uint(std::min(used.size(),
+                                                      (size_t)MT_DEFAULT));
+    this->nesting = std::max(this->nesting, (size_t)1);
+
     mapping = CreateBuffer(params.context,
                            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
                            sizeof(cl_uint) * matMapping.size(),
                            &matMapping[0]);
 
+    materials = CreateBuffer(params.context,
+                             CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                             sizeof(cl_material) * table.size(),
+                             &table[0]);
+
+    this->volumes = CreateBuffer(params.context,
+                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 sizeof(cl_volume) * volumes.Table().size(),
+                                 (void*)&volumes.Table()[0]);
+
+    this->grids = CreateBuffer(params.context,
+                               CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                               sizeof(cl_float) * volumes.Grids().size(),
+                               (void*)&volumes.Grids()[0]);
+
     fprintf(stderr, "Initialization complete.\n\n");
 }
 
+std::map<std::string, float> Materials::Emitters(pugi::xml_document& doc)
+{
+    std::vector<cl_material> presets = Presets();
+    std::map<std::string, float> emitters;
+
+    for (pugi::xml_node model : doc.child("materials").children("model"))
+    {
+        cl_material material = ParseMaterial(model, presets);
+        if (material.model != MODEL_LIGHT) continue;
+
+        emitters[model.attribute("ModelID").value()] = material.params.s[0];
+    }
+
+    return emitters;
+}
+
 void Materials::Bind(cl_uint* index)
 {
     fprintf(stderr, "Binding <mapping@Materials> to index %u.\n", *index);
     BindArgument(params.kernel, mapping, (*index)++);
+    fprintf(stderr, "Binding <materials@Materials> to index %u.\n", *index);
+    BindArgument(params.kernel, materials, (*index)++);
+    fprintf(stderr, "Binding <volumes@Materials> to index %u.\n", *index);
+    BindArgument(params.kernel, volumes, (*index)++);
+    fprintf(stderr, "Binding <grids@Materials> to index %u.\n", *index);
+    BindArgument(params.kernel, grids, (*index)++);
+}
+
+void Materials::Specialize(std::ostream& prelude)
+{
+    prelude << "#define SCENE_MODELS 0x" << std::hex << models << std::dec;
+    prelude << std::endl << "#define MT " << nesting << std::endl;
+    prelude << "#define SCENE_VOLUMES " << volumeCount << std::endl;
 }
 
 void Materials::Update(size_t /* index */)
@@ -0,0 +1,91 @@
+#include <material/volume.hpp>
+
+#include <common/error.hpp>
+#include <math/vector.hpp>
+#include <misc/xmlutils.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+/* Voxels along each side of a majorant cell, as in volume.cl. */
+#define MAJORANT_CELL 8
+
+Volumes::Volumes()
+{
+    cl_volume none;
+    memset(&none, 0, sizeof(cl_volume));
+    table.push_back(none);
+
+    /* Buffers can't be empty, the kernel won't read this anyway. */
+    grids.push_back(0);
+}
+
+cl_uint Volumes::Load(pugi::xml_node node, const std::string& source)
+{
+    std::string file = node.attribute("Grid").value();
+    size_t width = std::max(node.attribute("Width").as_uint(1), 1u);
+    size_t height = std::max(node.attribute("Height").as_uint(1), 1u);
+    size_t depth = std::max(node.attribute("Depth").as_uint(1), 1u);
+    float scale = node.attribute("Scale").as_float(1.0f);
+    size_t count = width * height * depth;
+
+    fprintf(stderr, "Loading '*/%s' (%lux%lux%lu).\n", file.c_str(),
+            (unsigned long)width, (unsigned long)height,
+            (unsigned long)depth);
+
+    std::fstream stream(source + "/" + file,
+                        std::fstream::in | std::fstream::binary);
+    if (!stream.is_open()) Error::Check(Error::IO, 0, true);
+
+    std::vector<cl_float> densities(count);
+    stream.read((char*)&densities[0], sizeof(cl_float) * count);
+    if (!stream) Error::Check(Error::IO, 0, true);
+
+    for (size_t t = 0; t < count; ++t)
+        densities[t] = std::max(densities[t] * scale, 0.0f);
+
+    cl_volume volume;
+    memset(&volume, 0, sizeof(cl_volume));
+    parseVector(node.child("lower")).CL(&volume.lower);
+    parseVector(node.child("upper")).CL(&volume.upper);
+    volume.size.s[0] = width;
+    volume.size.s[1] = height;
+    volume.size.s[2] = depth;
+    volume.size.s[3] = grids.size();
+
+    /* Find the largest density in each block of voxels, the last blocks *
+     * along each axis being cut short if the grid's size doesn't divide. */
+    size_t cw = (width + MAJORANT_CELL - 1) / MAJORANT_CELL;
+    size_t ch = (height + MAJORANT_CELL - 1) / MAJORANT_CELL;
+    size_t cd = (depth + MAJORANT_CELL - 1) / MAJORANT_CELL;
+    std::vector<cl_float> majorants(cw * ch * cd, 0.0f);
+
+    for (size_t z = 0; z < depth; ++z)
+        for (size_t y = 0; y < height; ++y)
+            for (size_t x = 0; x < width; ++x)
+            {
+                size_t cell = ((z / MAJORANT_CELL) * ch + y / MAJORANT_CELL)
+                            * cw + x / MAJORANT_CELL;
+                majorants[cell] = std::max(majorants[cell],
+                    densities[(z * height + y) * width + x]);
+            }
+
+    size_t empty = std::count(majorants.begin(), majorants.end(), 0.0f);
+    fprintf(stderr, "Majorant grid is %lux%lux%lu, %lu cells are empty.\n",
+            (unsigned long)cw, (unsigned long)ch, (unsigned long)cd,
+            (unsigned long)empty);
+
+    grids.insert(grids.end(), densities.begin(), densities.end());
+
+    volume.coarse.s[0] = cw;
+    volume.coarse.s[1] = ch;
+    volume.coarse.s[2] = cd;
+    volume.coarse.s[3] = grids.size();
+
+    grids.insert(grids.end(), majorants.begin(), majorants.end());
+
+    table.push_back(volume);
+    return table.size() - 1;
+}
@@ -4,6 +4,8 @@
 #include <misc/pugixml.hpp>
 
 #include <cmath>
+#include <cstdio>
+#include <sstream>
 
 struct cl_data
 {
@@ -13,6 +15,18 @@ struct cl_data
     cl_float spread;    /* The focal spread, or aperture radius.          */
 };
 
+/* Prints a vector as an OpenCL literal, with enough digits to round-trip. */
+static void Literal(std::ostream& out, const cl_float4& v, size_t n)
+{
+    char literal[32];
+    out << "(float" << n << ")(";
+    for (size_t t = 0; t < n; ++t)
+    {
+        snprintf(literal, sizeof(literal), "%#.9gf", v.s[t]);
+        out << literal << ((t < n - 1) ? ", " : ")");
+    }
+}
+
 Camera::Camera(EngineParams& params) : KernelObject(params)
 {
     fprintf(stderr, "Initializing <Camera>.\n");
@@ -81,10 +95,33 @@ Camera::Camera(EngineParams& params) : KernelObject(params)
     WriteToBuffer(params.queue, this->buffer, CL_TRUE,
                   0, sizeof(cl_data), &data);
 
+    /* Also prepare the same data as an OpenCL initializer. */
+    std::stringstream text;
+    text << "{ { ";
+    for (size_t t = 0; t < 4; ++t)
+    {
+        Literal(text, data.p[t], 4);
+        text << ((t < 3) ? ", " : " }, ");
+    }
+
+    Literal(text, data.pos, 3);  text << ", ";
+    Literal(text, data.up, 3);   text << ", ";
+    Literal(text, data.left, 3); text << ", ";
+
+    char spread[32];
+    snprintf(spread, sizeof(spread), "%#.9gf }", data.spread);
+    text << spread;
+    this->initializer = text.str();
+
     fprintf(stderr, "Initialization complete.\n\n");
     stream.close();
 }
 
+void Camera::Specialize(std::ostream& prelude)
+{
+    prelude << "#define SCENE_CAMERA " << initializer << std::endl;
+}
+
 void Camera::Bind(cl_uint* index)
 {
     fprintf(stderr, "Binding <buffer@Camera> to index %u.\n", *index);
@@ -1,31 +1,53 @@
 #include <math/prng.hpp>
 
-/* Device-side representation. */
-struct cl_prng { cl_ulong4 seed; };
+#include <algorithm>
 
 PRNG::PRNG(EngineParams& params) : KernelObject(params)
 {
     fprintf(stderr, "Initializing <PRNG>...");
 
-    this->buffer = CreateBuffer(params.context, CL_MEM_READ_ONLY,
-                                sizeof(cl_prng), nullptr);
+    /* The key never changes, so it is only uploaded once. */
+    cl_ulong4 key;
+    key.s[0] = this->seed = 0;
+    key.s[1] = 0;
+    key.s[2] = 0;
+    key.s[3] = 0;
 
-    this->seed = 0;
+    this->buffer = CreateBuffer(params.context,
+                                CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                sizeof(cl_ulong4), &key);
 
     fprintf(stderr, " complete.\n\n");
 }
 
+void PRNG::SetRange(size_t launch)
+{
+    size_t first = launch * params.options.samplesPerLaunch;
+    cl_uint count = (cl_uint)std::min(params.options.samplesPerLaunch,
+                                      params.passes - first);
+
+    /* Kernel arguments are captured at enqueue time, so this can safely be *
+     * done while previously enqueued launches are still in flight.       */
+    BindArgument(params.kernel, (cl_uint)first, this->slot + 0);
+    BindArgument(params.kernel, count, this->slot + 1);
+}
+
 void PRNG::Bind(cl_uint* index)
 {
     fprintf(stderr, "Binding <buffer@PRNG> to index %u.\n", *index);
     BindArgument(params.kernel, buffer, (*index)++);
+    fprintf(stderr, "Binding <range@PRNG> to index %u.\n", *index);
+    this->slot = *index;
+    (*index) += 2;
+
+    SetRange(0);
 }
 
-void PRNG::Update(size_t /* index */)
+void PRNG::Update(size_t index)
 {
-    WriteToBuffer(params.queue, this->buffer, CL_TRUE,
-                  0, sizeof(uint64_t), &this->seed);
-    this->seed++;
+    /* Prepare the next launch, if there is one. */
+    if ((index + 1) * params.options.samplesPerLaunch < params.passes)
+        SetRange(index + 1);
 }
 
 void* PRNG::Query(size_t /* query */)
@@ -1,5 +1,6 @@
 #include <misc/misc.hpp>
 
+#include <algorithm>
 #include <ctime>
 
 Progress::Progress(EngineParams& params) : KernelObject(params)
@@ -7,6 +8,7 @@ Progress::Progress(EngineParams& params) : KernelObject(params)
     this->progress = 0;
     this->elapsed = 0.0;
     this->remains = -1.0;
+    this->completed = 0;
 }
 
 void Progress::Bind(cl_uint* /* index */)
@@ -20,9 +22,27 @@ void Progress::Bind(cl_uint* /* index */)
     #endif
 }
 
-void Progress::Update(size_t pass)
+void Progress::Update(size_t /* index */)
 {
-    this->progress = (double)(pass + 1) / params.passes;
+    cl_int error = params.launch.setCallback(CL_COMPLETE, Progress::Completed,
+                                             this);
+    Error::Check(Error::Execute, error);
+}
+
+void CL_CALLBACK Progress::Completed(cl_event /* event */, cl_int status,
+                                     void* data)
+{
+    /* Launches complete in order, since the command queue is in-order. */
+    if (status == CL_COMPLETE) ++((Progress*)data)->completed;
+}
+
+void Progress::Refresh()
+{
+    /* Passes done so far, the last launch may have rendered fewer. */
+    size_t done = this->completed * params.options.samplesPerLaunch;
+    done = std::min(done, params.passes);
+
+    this->progress = (double)done / params.passes;
 
     #ifdef LOW_RES_TIMER
     time_t now = time(nullptr);
@@ -38,21 +58,55 @@ void Progress::Update(size_t pass)
     elapsed = time - startTime;
     #endif
 
-    if (elapsed < 5)
+    if ((elapsed < 5) || (done == 0))
     {
         remains = -1.0; /* Indeterminate. */
     }
     else
     {
-        double position = (double)(params.passes - pass - 1) / (pass + 1);
+        double position = (double)(params.passes - done) / done;
         remains = elapsed * position;
     }
 }
 
 void* Progress::Query(size_t query)
 {
+    Refresh();
+
     if (query == Query::Progress) return &this->progress;
     if (query == Query::EstimatedTime) return &this->remains;
     if (query == Query::ElapsedTime) return &this->elapsed;
     return nullptr;
 }
+
+/******************************************************************************/
+
+WorkQueue::WorkQueue(EngineParams& params) : KernelObject(params)
+{
+    fprintf(stderr, "Initializing <WorkQueue>...");
+
+    this->zero = 0;
+    this->counter = CreateBuffer(params.context,
+                                 CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                 sizeof(cl_uint), &this->zero);
+
+    fprintf(stderr, " complete.\n\n");
+}
+
+void WorkQueue::Bind(cl_uint* index)
+{
+    fprintf(stderr, "Binding <counter@WorkQueue> to index %u.\n", *index);
+    BindArgument(params.kernel, counter, (*index)++);
+}
+
+void WorkQueue::Update(size_t /* index */)
+{
+    /* The queue is in-order, so the next pass will see the rewind. */
+    WriteToBuffer(params.queue, this->counter, CL_FALSE,
+                  0, sizeof(cl_uint), &this->zero);
+}
+
+void* WorkQueue::Query(size_t /* query */)
+{
+    return nullptr;
+}
@@ -0,0 +1,102 @@
+#include <render/photonmap.hpp>
+
+#include <vector>
+
+struct cl_visible_point
+{
+    cl_float4 beta;     /* Camera path throughput.              */
+    cl_float4 p;        /* Location.                            */
+    cl_float4 b, n, t;  /* Surface basis.                       */
+    cl_float4 incident; /* Incident direction, in TBN space.    */
+    cl_uint4 media;     /* Media, and nesting.                  */
+};
+
+struct cl_photon_stats
+{
+    cl_float4 flux;     /* Flux gathered during this iteration. */
+    cl_float4 tau;      /* Flux kept so far, and photon count.  */
+    cl_float4 direct;   /* Sum of the directly seen radiance.   */
+    cl_float radius2;   /* Squared gathering radius.            */
+    cl_uint count;      /* Photons gathered this iteration.     */
+    cl_uint padding[2]; /* The kernel aligns this to 16 bytes.  */
+};
+
+/* The stages of an SPPM iteration, as in sppm.cl. */
+#define STAGE_VISIBLE 0
+#define STAGE_PHOTONS 1
+#define STAGE_UPDATE  2
+
+/* Work group size of the photon and update stages. */
+#define STAGE_LOCAL_SIZE 64
+
+PhotonMap::PhotonMap(EngineParams& params) : KernelObject(params)
+{
+    fprintf(stderr, "Initializing <PhotonMap>.\n");
+
+    size_t cells = params.width * params.height;
+
+    /* The gathering radii are set up by the kernel, from the scene's size. */
+    std::vector<cl_photon_stats> zeros(cells, cl_photon_stats());
+    stats = CreateBuffer(params.context,
+                         CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                         sizeof(cl_photon_stats) * cells, &zeros[0]);
+
+    std::vector<cl_visible_point> none(cells, cl_visible_point());
+    points = CreateBuffer(params.context,
+                          CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                          sizeof(cl_visible_point) * cells, &none[0]);
+
+    /* One bucket per pixel, all empty, then the number of entries. */
+    std::vector<cl_uint> buckets(cells + 1, (cl_uint)-1);
+    buckets[cells] = 0;
+    grid = CreateBuffer(params.context,
+                        CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                        sizeof(cl_uint) * buckets.size(), &buckets[0]);
+
+    /* Each visible point overlaps at most eight cells. */
+    entries = CreateBuffer(params.context, CL_MEM_READ_WRITE,
+                           sizeof(cl_uint2) * cells * 8, nullptr);
+
+    unsigned long photons = params.Photons();
+    fprintf(stderr, "Tracing %lu photons per iteration.\n", photons);
+    fprintf(stderr, "Initialization complete.\n\n");
+}
+
+void PhotonMap::Bind(cl_uint* index)
+{
+    fprintf(stderr, "Binding <stats@PhotonMap> to index %u.\n", *index);
+    BindArgument(params.kernel, stats, (*index)++);
+    fprintf(stderr, "Binding <points@PhotonMap> to index %u.\n", *index);
+    BindArgument(params.kernel, points, (*index)++);
+    fprintf(stderr, "Binding <grid@PhotonMap> to index %u.\n", *index);
+    BindArgument(params.kernel, grid, (*index)++);
+    fprintf(stderr, "Binding <entries@PhotonMap> to index %u.\n", *index);
+    BindArgument(params.kernel, entries, (*index)++);
+    fprintf(stderr, "Binding <stage@PhotonMap> to index %u.\n", *index);
+    this->slot = (*index)++;
+
+    BindArgument(params.kernel, (cl_uint)STAGE_VISIBLE, this->slot);
+}
+
+void PhotonMap::Update(size_t /* index */)
+{
+    /* Kernel arguments are captured at enqueue time, and the queue is in *
+     * order, so the stages run after the launch which traced the visible *
+     * points, with the same sample range (the PRNG updates it later).    */
+    size_t photons = RoundUp(params.Photons(), STAGE_LOCAL_SIZE);
+    BindArgument(params.kernel, (cl_uint)STAGE_PHOTONS, this->slot);
+    ExecuteKernel(params.queue, params.kernel, cl::NullRange,
+                  cl::NDRange(photons), cl::NDRange(STAGE_LOCAL_SIZE));
+
+    size_t pixels = RoundUp(params.width * params.height, STAGE_LOCAL_SIZE);
+    BindArgument(params.kernel, (cl_uint)STAGE_UPDATE, this->slot);
+    ExecuteKernel(params.queue, params.kernel, cl::NullRange,
+                  cl::NDRange(pixels), cl::NDRange(STAGE_LOCAL_SIZE));
+
+    BindArgument(params.kernel, (cl_uint)STAGE_VISIBLE, this->slot);
+}
+
+void* PhotonMap::Query(size_t /* query */)
+{
+    return nullptr;
+}
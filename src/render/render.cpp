@@ -1,13 +1,26 @@
 #include <render/render.hpp>
 #include <common/version.hpp>
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 struct cl_buffer
 {
     cl_uint width, height;
 };
 
+/* Converts a half, as stored by the kernel, to a float. */
+static float HalfToFloat(cl_half h)
+{
+    int exponent = (h >> 10) & 0x1F, mantissa = h & 0x3FF;
+    float value = (exponent == 0x1F) ? (mantissa ? NAN : INFINITY)
+                : (exponent == 0) ? ldexp((float)mantissa, -24)
+                : ldexp((float)(mantissa | 0x400), exponent - 25);
+
+    return (h & 0x8000) ? -value : value;
+}
+
 PixelBuffer::PixelBuffer(EngineParams& params) : KernelObject(params)
 {
     fprintf(stderr, "Initializing <PixelBuffer>...\n");
@@ -23,8 +36,55 @@ PixelBuffer::PixelBuffer(EngineParams& params) : KernelObject(params)
 
     for (size_t t = 0; t < floatCount; ++t) pixels[t] = 0.0f;
 
-    pb = CreateBuffer(params.context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
-                      floatCount * sizeof(float), pixels);
+    if (params.options.accumulation == "half")
+    {
+        /* The device only holds the samples since the last flush. */
+        compact.resize(floatCount, 0);
+        zeros.resize(floatCount, 0);
+        pb = CreateBuffer(params.context,
+                          CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                          floatCount * sizeof(cl_half), &zeros[0]);
+
+        fprintf(stderr, "Flushing the half pixel buffer every %lu launches.\n",
+                (unsigned long)params.options.flushInterval);
+    }
+    else
+        pb = CreateBuffer(params.context,
+                          CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                          floatCount * sizeof(float), pixels);
+
+    flushing = false;
+
+    /* Without adaptive sampling, the kernel won't use these buffers. */
+    size_t pixelCount = 1, slots = 0;
+    if (params.options.adaptiveInterval)
+    {
+        pixelCount = params.width * params.height;
+        slots = params.PixelSlots();
+    }
+
+    std::vector<cl_float> zeros(pixelCount, 0.0f);
+    moments = CreateBuffer(params.context,
+                           CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                           sizeof(cl_float) * pixelCount, &zeros[0]);
+
+    /* Every pixel is rendered until the first update. */
+    std::vector<cl_uint> list(slots + 1);
+    list[0] = activeCount = (cl_uint)slots;
+    for (size_t t = 0; t < slots; ++t) list[t + 1] = (cl_uint)t;
+
+    active = CreateBuffer(params.context,
+                          CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                          sizeof(cl_uint) * list.size(), &list[0]);
+
+    /* Likewise, without splitting, the kernel won't use this buffer. */
+    size_t splitCount = (params.options.maxSplit > 1)
+                      ? params.width * params.height : 1;
+
+    std::vector<cl_float4> stats(splitCount, cl_float4());
+    splitting = CreateBuffer(params.context,
+                             CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             sizeof(cl_float4) * splitCount, &stats[0]);
 
     fprintf(stderr, "Initialization complete.\n\n");
 }
@@ -37,13 +97,46 @@ PixelBuffer::~PixelBuffer()
     delete[] pixels;
 }
 
-void PixelBuffer::Update(size_t /* index */)
+void PixelBuffer::Specialize(std::ostream& prelude)
 {
-    return;
+    prelude << "#define SCENE_WIDTH " << params.width << std::endl;
+    prelude << "#define SCENE_HEIGHT " << params.height << std::endl;
 }
 
-void* PixelBuffer::Query(size_t /* query */)
+void PixelBuffer::Update(size_t index)
 {
+    /* Add the half buffer's samples to ours before they lose precision. */
+    if (params.options.accumulation == "half")
+    {
+        if ((index + 1) % params.options.flushInterval == 0) StartFlush();
+        return;
+    }
+
+    size_t interval = params.options.adaptiveInterval;
+    if ((interval == 0) || ((index + 1) % interval != 0)) return;
+
+    /* Rebuild the list after the launch, then wait for its length. */
+    cl_uint zero = 0;
+    WriteToBuffer(params.queue, active, CL_FALSE, 0, sizeof(cl_uint), &zero);
+
+    size_t slots = params.PixelSlots(), local = 64;
+    ExecuteKernel(params.queue, converge, cl::NullRange,
+                  cl::NDRange(((slots + local - 1) / local) * local),
+                  cl::NDRange(local));
+
+    ReadFromBuffer(params.queue, active, CL_TRUE, 0, sizeof(cl_uint),
+                   &activeCount);
+
+    fprintf(stderr, "--> %u of %lu pixels still active after launch %lu.\n",
+            activeCount, (unsigned long)(params.width * params.height),
+            (unsigned long)(index + 1));
+}
+
+void* PixelBuffer::Query(size_t query)
+{
+    if (params.options.adaptiveInterval && (query == Query::ActivePixels))
+        return &this->activeCount;
+
     return nullptr;
 }
 
@@ -53,14 +146,81 @@ void PixelBuffer::Bind(cl_uint* index)
     BindArgument(params.kernel, pb, (*index)++);
     fprintf(stderr, "Binding >rp@PixelBuffer> to index %u.\n", *index);
     BindArgument(params.kernel, rp, (*index)++);
+    fprintf(stderr, "Binding <moments@PixelBuffer> to index %u.\n", *index);
+    BindArgument(params.kernel, moments, (*index)++);
+    fprintf(stderr, "Binding <active@PixelBuffer> to index %u.\n", *index);
+    BindArgument(params.kernel, active, (*index)++);
+    fprintf(stderr, "Binding <splitting@PixelBuffer> to index %u.\n", *index);
+    BindArgument(params.kernel, splitting, (*index)++);
+
+    /* The program is built by now, so set up the list update kernel. */
+    if (params.options.adaptiveInterval)
+    {
+        converge = CreateKernel(params.program, "clconverge");
+        BindArgument(converge, pb, 0);
+        BindArgument(converge, rp, 1);
+        BindArgument(converge, moments, 2);
+        BindArgument(converge, active, 3);
+        BindArgument(converge, params.options.adaptiveThreshold, 4);
+
+        /* A pixel's estimated error can't be trusted from a few samples. */
+        size_t samples = params.options.adaptiveInterval
+                       * params.options.samplesPerLaunch;
+        cl_uint minSamples = (cl_uint)std::max(std::max(samples * 2,
+                                 params.options.adaptiveMinSamples), (size_t)2);
+        BindArgument(converge, minSamples, 5);
+    }
 }
 
 void PixelBuffer::Acquire(EngineParams& params)
 {
+    if (params.options.accumulation == "half")
+    {
+        StartFlush();
+        FinishFlush();
+        return;
+    }
+
     size_t bufSize = params.width * params.height * sizeof(float) * 4;
     ReadFromBuffer(params.queue, pb, CL_TRUE, 0, bufSize, pixels);
 }
 
+void PixelBuffer::StartFlush()
+{
+    /* The previous flush is long done by now, but its buffer is reused. */
+    FinishFlush();
+
+    /* The queue is in order, so the reset comes after the read, and both *
+     * after the launches already enqueued, which needn't be waited for.  */
+    size_t size = compact.size() * sizeof(cl_half);
+    ReadFromBuffer(params.queue, pb, CL_FALSE, 0, size, &compact[0], &flushed);
+    WriteToBuffer(params.queue, pb, CL_FALSE, 0, size, &zeros[0]);
+    flushing = true;
+}
+
+void PixelBuffer::FinishFlush()
+{
+    if (!flushing) return;
+    WaitForEvent(flushed);
+    flushing = false;
+
+    /* The kernel stores each pixel's mean color, and its sample count, *
+     * and the samples still count if their color isn't finite somehow. */
+    for (size_t t = 0; t < params.width * params.height; ++t)
+    {
+        float n = HalfToFloat(compact[t * 4 + 3]);
+        if (n == 0.0f) continue;
+
+        for (size_t c = 0; c < 3; ++c)
+        {
+            float mean = HalfToFloat(compact[t * 4 + c]);
+            if (std::isfinite(mean)) pixels[t * 4 + c] += mean * n;
+        }
+
+        pixels[t * 4 + 3] += n;
+    }
+}
+
 void PixelBuffer::WriteToFile(std::string path)
 {
     std::ofstream file;
@@ -114,28 +274,44 @@ struct XYZp
     XYZp(float x, float y, float z) : x(x), y(y), z(z), p(1.0f) { };
 };
 
+/* Fraction of the wavelength sampling density which is uniform, so that no *
+ * wavelength is left with a vanishing density, and a huge weight.         */
+#define SPECTRAL_UNIFORM 0.05
+
 Tristimulus::Tristimulus(EngineParams& params) : KernelObject(params)
 {
     size_t res = Spectral::Resolution();
+    Spectral::XYZ* curve = Spectral::Curve();
     fprintf(stderr, "Initializing <Tristimulus>.\n");
     fprintf(stderr, "Spectral resolution: %.1fnm.\n", 400.0 / (res - 1));
 
-    cl::ImageFormat format(CL_RGBA, CL_FLOAT);
-    this->buffer = CreateImage2D(params.context, CL_MEM_READ_ONLY, format,
-                                 res, 1);
+    /* Weight the intervals between wavelengths by their X + Y + Z. */
+    std::vector<double> weights(res - 1);
+    double total = 0;
 
-    cl::size_t<3> origin;
-    origin[0] = 0;
-    origin[1] = 0;
-    origin[2] = 0;
+    for (size_t t = 0; t < res - 1; ++t)
+    {
+        for (size_t c = 0; c < 3; ++c)
+            weights[t] += 0.5 * (curve[t].data.s[c] + curve[t + 1].data.s[c]);
+
+        total += weights[t];
+    }
 
-    cl::size_t<3> region;
-    region[0] = res;
-    region[1] = 1;
-    region[2] = 1;
+    /* Store the cumulative distribution next to the XYZ colors. */
+    std::vector<cl_float4> table(res);
+    double cdf = 0;
+
+    for (size_t t = 0; t < res; ++t)
+    {
+        table[t] = curve[t].data;
+        table[t].s[3] = (t == res - 1) ? 1.0f : (float)cdf;
+        if (t < res - 1) cdf += (1 - SPECTRAL_UNIFORM) * weights[t] / total
+                              + SPECTRAL_UNIFORM / (res - 1);
+    }
 
-    WriteToImage2D(params.queue, this->buffer, CL_TRUE, origin, region,
-                   Spectral::Curve());
+    this->buffer = CreateBuffer(params.context,
+                                CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                res * sizeof(cl_float4), &table[0]);
     fprintf(stderr, "Initialization complete.\n\n");
 }
 
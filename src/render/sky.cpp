@@ -0,0 +1,213 @@
+#include <render/sky.hpp>
+#include <geometry/lighttree.hpp>
+#include <math/vector.hpp>
+#include <misc/xmlutils.hpp>
+#include <misc/pugixml.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+struct cl_sky
+{
+    cl_float skyTemperature; /* Black body temperature of the sky.  */
+    cl_float sunTemperature; /* Black body temperature of the sun.  */
+    cl_uint width;           /* Sky map width, zero if no sky.      */
+    cl_uint height;          /* Sky map height (half of the width). */
+};
+
+/* Number of subdivisions per texel side, to find the sun's coverage. */
+#define SUN_SUBDIVISIONS 8
+
+/* Returns the direction at the given latitude-longitude coordinates. */
+static Vector Direction(float theta, float phi)
+{
+    return Vector(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+/* Relative brightness of the clear sky in some direction, for a given sun  *
+ * direction: brighter towards the horizon, and around the sun, following  *
+ * the Rayleigh phase function. Below the horizon, the ground reflects it. */
+static float Atmosphere(const Vector& direction, const Vector& sun,
+                        float ground)
+{
+    if (direction.y <= 0) return ground;
+
+    float cosGamma = dot(direction, sun);
+    float horizon = 1 - 0.5f * exp(-0.3f / std::max(direction.y, 0.01f));
+    return 0.75f * (1 + cosGamma * cosGamma) * horizon;
+}
+
+Sky::Sky(EngineParams& params) : KernelObject(params)
+{
+    fprintf(stderr, "Initializing <Sky>.\n");
+    fprintf(stderr, "Loading '*/sky.xml'.\n");
+
+    cl_sky sky = { 0, 0, 0, 0 };
+    std::vector<cl_float4> texels;
+    std::vector<cl_float> cdfs;
+
+    /* The sky is optional, so its absence isn't an error. */
+    std::fstream stream(params.source + "/sky.xml",
+                        std::fstream::in | std::fstream::binary);
+
+    if (!stream.is_open()) fprintf(stderr, "No sky, escaped rays are lost.\n");
+    else
+    {
+        pugi::xml_document doc;
+        ParseXML(doc, stream);
+
+        pugi::xml_node node = doc.child("sky");
+        size_t height = std::max(node.attribute("Resolution").as_uint(256), 1u);
+        size_t width = 2 * height;
+
+        pugi::xml_node sunNode = node.child("sun");
+        float azimuth = sunNode.attribute("Azimuth").as_float(0.0f);
+        float elevation = sunNode.attribute("Elevation").as_float(45.0f);
+        float radius = sunNode.attribute("Radius").as_float(0.27f);
+        float sunIntensity = sunNode.attribute("Intensity").as_float(1.0f);
+        sky.sunTemperature = sunNode.attribute("Temperature").as_float(5800);
+
+        pugi::xml_node airNode = node.child("atmosphere");
+        float skyIntensity = airNode.attribute("Intensity").as_float(0.05f);
+        float ground = airNode.attribute("Ground").as_float(0.1f);
+        sky.skyTemperature = airNode.attribute("Temperature").as_float(12000);
+
+        Vector sun = Direction((PI / 180) * (90 - elevation),
+                               (PI / 180) * azimuth);
+        float cosRadius = cos((PI / 180) * radius);
+
+        fprintf(stderr, "Sky map is %lux%lu, sun at (%.2f, %.2f, %.2f).\n",
+                (unsigned long)width, (unsigned long)height,
+                sun.x, sun.y, sun.z);
+
+        /* Tabulate the sky, and the sun's coverage of each texel. */
+        texels.resize(width * height);
+        std::vector<float> solidAngles(height);
+        double sunPower = 0;
+
+        for (size_t i = 0; i < height; ++i)
+        {
+            float theta0 = PI * i / height, theta1 = PI * (i + 1) / height;
+            solidAngles[i] = (2 * PI / width) * (cos(theta0) - cos(theta1));
+
+            for (size_t j = 0; j < width; ++j)
+            {
+                float theta = PI * (i + 0.5f) / height;
+                float phi = 2 * PI * (j + 0.5f) / width;
+                Vector direction = Direction(theta, phi);
+
+                size_t covered = 0;
+                for (size_t u = 0; u < SUN_SUBDIVISIONS; ++u)
+                    for (size_t v = 0; v < SUN_SUBDIVISIONS; ++v)
+                    {
+                        float s = (u + 0.5f) / SUN_SUBDIVISIONS;
+                        float t = (v + 0.5f) / SUN_SUBDIVISIONS;
+                        Vector d = Direction(PI * (i + s) / height,
+                                             2 * PI * (j + t) / width);
+                        if (dot(d, sun) >= cosRadius) ++covered;
+                    }
+
+                cl_float4& texel = texels[i * width + j];
+                texel.s[0] = skyIntensity * Atmosphere(direction, sun, ground);
+                texel.s[1] = (float)covered / (SUN_SUBDIVISIONS
+                                             * SUN_SUBDIVISIONS);
+                texel.s[2] = texel.s[3] = 0;
+                sunPower += texel.s[1] * solidAngles[i];
+            }
+        }
+
+        /* Rescale the sun so that it covers its solid angle exactly, even if *
+         * it is too small for the subdivisions, then it takes a single texel. */
+        if (sunPower == 0)
+        {
+            float theta = acos(std::min(std::max(sun.y, -1.0f), 1.0f));
+            float phi = atan2(sun.z, sun.x);
+            if (phi < 0) phi += 2 * PI;
+
+            size_t i = std::min((size_t)(theta / PI * height), height - 1);
+            size_t j = std::min((size_t)(phi / (2 * PI) * width), width - 1);
+            texels[i * width + j].s[1] = 1;
+            sunPower = solidAngles[i];
+        }
+
+        float sunSolidAngle = 2 * PI * (1 - cosRadius);
+        for (size_t t = 0; t < texels.size(); ++t)
+            texels[t].s[1] *= sunIntensity * sunSolidAngle / sunPower;
+
+        /* Build the distributions, by visible power per texel. */
+        float skyPower = LightTree::VisiblePower(sky.skyTemperature);
+        float starPower = LightTree::VisiblePower(sky.sunTemperature);
+        cdfs.resize(height + width * height);
+        std::vector<double> rows(height);
+        double total = 0;
+
+        for (size_t i = 0; i < height; ++i)
+        {
+            double row = 0;
+            for (size_t j = 0; j < width; ++j)
+            {
+                cl_float4& texel = texels[i * width + j];
+                texel.s[2] = texel.s[0] * skyPower + texel.s[1] * starPower;
+                row += texel.s[2] * solidAngles[i];
+                cdfs[height + i * width + j] = (cl_float)row;
+            }
+
+            for (size_t j = 0; j < width; ++j)
+                cdfs[height + i * width + j] = (row == 0) ? (j + 1.0f) / width
+                    : (j == width - 1) ? 1.0f
+                    : (cl_float)(cdfs[height + i * width + j] / row);
+
+            total += row;
+            rows[i] = total;
+        }
+
+        if (total == 0) fprintf(stderr, "The sky is black, it is disabled.\n");
+        else
+        {
+            /* Each texel's density, per solid angle, is its visible power. */
+            for (size_t i = 0; i < height; ++i)
+                cdfs[i] = (i == height - 1) ? 1.0f : (cl_float)(rows[i] / total);
+
+            for (size_t t = 0; t < texels.size(); ++t)
+                texels[t].s[2] = (cl_float)(texels[t].s[2] / total);
+
+            sky.width = width;
+            sky.height = height;
+        }
+    }
+
+    /* Buffers can't be empty, the kernel won't read these anyway. */
+    if (texels.empty()) texels.push_back(cl_float4());
+    if (cdfs.empty()) cdfs.push_back(0);
+
+    this->map = CreateBuffer(params.context,
+                             CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                             sizeof(cl_float4) * texels.size(),
+                             &texels[0]);
+
+    this->cdf = CreateBuffer(params.context,
+                             CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                             sizeof(cl_float) * cdfs.size(),
+                             &cdfs[0]);
+
+    this->buffer = CreateBuffer(params.context,
+                                CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                sizeof(cl_sky), &sky);
+
+    fprintf(stderr, "Initialization complete.\n\n");
+}
+
+void Sky::Bind(cl_uint* index)
+{
+    fprintf(stderr, "Binding <map@Sky> to index %u.\n", *index);
+    BindArgument(params.kernel, map, (*index)++);
+    fprintf(stderr, "Binding <cdf@Sky> to index %u.\n", *index);
+    BindArgument(params.kernel, cdf, (*index)++);
+    fprintf(stderr, "Binding <buffer@Sky> to index %u.\n", *index);
+    BindArgument(params.kernel, buffer, (*index)++);
+}
+
+void Sky::Update(size_t /* index */) { return; }
+void* Sky::Query(size_t /* query */) { return nullptr; }